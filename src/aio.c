@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "aio.h"
+#include "mount.h"
+#include "bcache.h"
+#include "error.h"
+
+
+/**
+ * @brief do one request synchronously
+ */
+static int aio_transfer(const struct unix_filesystem *u, struct aio_request *req)
+{
+	struct iovec iov = { req->data, (size_t)req->count * SECTOR_SIZE };
+	return sector_transfer(u, req->sector, &iov, 1, req->write);
+}
+
+
+static void *aio_worker(void *arg)
+{
+	struct aio_engine *engine = arg;
+
+	pthread_mutex_lock(&engine->lock);
+	for (;;) {
+		while (engine->head == NULL && !engine->stop) {
+			pthread_cond_wait(&engine->work, &engine->lock);
+		}
+		if (engine->head == NULL) {
+			break;
+		}
+
+		// take the oldest request and do it without the lock
+		struct aio_request *req = engine->head;
+		engine->head = req->next;
+		if (engine->head == NULL) {
+			engine->tail = NULL;
+		}
+		pthread_mutex_unlock(&engine->lock);
+
+		int error = aio_transfer(engine->u, req);
+
+		pthread_mutex_lock(&engine->lock);
+		req->error = error;
+		--req->batch->pending;
+		pthread_cond_broadcast(&engine->done);
+	}
+	pthread_mutex_unlock(&engine->lock);
+	return NULL;
+}
+
+
+struct aio_engine *aio_alloc(const struct unix_filesystem *u, unsigned int threads)
+{
+	// test argument
+	if (u == NULL) {
+		return NULL;
+	}
+
+	struct aio_engine *engine = calloc(1, sizeof(struct aio_engine));
+	if (!engine) {
+		return NULL;
+	}
+	engine->u = u;
+	engine->backend = AIO_SYNC;
+
+	// stdio cannot be shared, and a mapped disk is only copied from
+	if (u->io_mode != SECTOR_IO_PREAD) {
+		return engine;
+	}
+
+	if (threads == 0) {
+		return engine;
+	}
+	engine->threads = calloc(threads, sizeof(pthread_t));
+	if (!engine->threads) {
+		free(engine);
+		return NULL;
+	}
+	pthread_mutex_init(&engine->lock, NULL);
+	pthread_cond_init(&engine->work, NULL);
+	pthread_cond_init(&engine->done, NULL);
+	engine->backend = AIO_THREADS;
+
+	// a smaller pool is fine if some threads cannot start
+	for (; engine->nthreads < threads; ++engine->nthreads) {
+		if (pthread_create(&engine->threads[engine->nthreads], NULL, aio_worker, engine)) {
+			break;
+		}
+	}
+	if (engine->nthreads == 0) {
+		aio_free(engine);
+		return NULL;
+	}
+	return engine;
+}
+
+
+void aio_free(struct aio_engine *engine)
+{
+	if (!engine) {
+		return;
+	}
+
+	if (engine->backend == AIO_THREADS) {
+		pthread_mutex_lock(&engine->lock);
+		engine->stop = 1;
+		pthread_cond_broadcast(&engine->work);
+		pthread_mutex_unlock(&engine->lock);
+		for (size_t i = 0; i < engine->nthreads; ++i) {
+			pthread_join(engine->threads[i], NULL);
+		}
+		pthread_cond_destroy(&engine->done);
+		pthread_cond_destroy(&engine->work);
+		pthread_mutex_destroy(&engine->lock);
+	}
+	free(engine->threads);
+	free(engine);
+}
+
+
+void aio_batch_init(struct aio_batch *batch)
+{
+	if (batch != NULL) {
+		memset(batch, 0, sizeof(*batch));
+	}
+}
+
+
+void aio_batch_free(struct aio_batch *batch)
+{
+	if (batch != NULL) {
+		free(batch->reqs);
+		memset(batch, 0, sizeof(*batch));
+	}
+}
+
+
+int aio_batch_add(struct aio_batch *batch, uint32_t sector, uint32_t count,
+		  void *data, int write)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(batch);
+	M_REQUIRE_NON_NULL(data);
+	if (count == 0 || batch->pending > 0) {
+		return ERR_BAD_PARAMETER;
+	}
+
+	// make room, doubling the array
+	if (batch->count == batch->capacity) {
+		size_t capacity = batch->capacity ? 2 * batch->capacity : 8;
+		struct aio_request *reqs = realloc(batch->reqs, capacity * sizeof(*reqs));
+		if (!reqs) {
+			return ERR_NOMEM;
+		}
+		batch->reqs = reqs;
+		batch->capacity = capacity;
+	}
+
+	struct aio_request *req = &batch->reqs[batch->count++];
+	memset(req, 0, sizeof(*req));
+	req->sector = sector;
+	req->count = count;
+	req->data = data;
+	req->write = write ? 1 : 0;
+	return 0;
+}
+
+
+int aio_submit(struct aio_engine *engine, struct aio_batch *batch)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(engine);
+	M_REQUIRE_NON_NULL(batch);
+
+	int reads = 0;
+	for (size_t i = 0; i < batch->count; ++i) {
+		batch->reqs[i].batch = batch;
+		batch->reqs[i].error = 0;
+		batch->reqs[i].next = NULL;
+		reads |= !batch->reqs[i].write;
+	}
+
+	// the disk must hold what the buffer cache has not written back yet
+	if (reads) {
+		int error = sector_flush(engine->u);
+		if (error) {
+			return error;
+		}
+	}
+
+	switch (engine->backend) {
+	case AIO_THREADS:
+		// append the whole batch to the queue at once
+		if (batch->count == 0) {
+			return 0;
+		}
+		for (size_t i = 0; i + 1 < batch->count; ++i) {
+			batch->reqs[i].next = &batch->reqs[i + 1];
+		}
+		pthread_mutex_lock(&engine->lock);
+		batch->pending = batch->count;
+		if (engine->tail) {
+			engine->tail->next = &batch->reqs[0];
+		} else {
+			engine->head = &batch->reqs[0];
+		}
+		engine->tail = &batch->reqs[batch->count - 1];
+		pthread_cond_broadcast(&engine->work);
+		pthread_mutex_unlock(&engine->lock);
+		return 0;
+	default:
+		for (size_t i = 0; i < batch->count; ++i) {
+			batch->reqs[i].error = aio_transfer(engine->u, &batch->reqs[i]);
+		}
+		return 0;
+	}
+}
+
+
+int aio_wait(struct aio_engine *engine, struct aio_batch *batch)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(engine);
+	M_REQUIRE_NON_NULL(batch);
+
+	switch (engine->backend) {
+	case AIO_THREADS:
+		pthread_mutex_lock(&engine->lock);
+		while (batch->pending > 0) {
+			pthread_cond_wait(&engine->done, &engine->lock);
+		}
+		pthread_mutex_unlock(&engine->lock);
+		break;
+	default:
+		break;
+	}
+
+	// the cache must not keep what was overwritten
+	int error = 0;
+	for (size_t i = 0; i < batch->count; ++i) {
+		const struct aio_request *req = &batch->reqs[i];
+		if (req->write && engine->u->cache != NULL) {
+			bcache_invalidate(engine->u->cache, req->sector, req->count);
+		}
+		if (!error) {
+			error = req->error;
+		}
+	}
+	return error;
+}
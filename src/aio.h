@@ -0,0 +1,121 @@
+#pragma once
+
+/**
+ * @file aio.h
+ * @brief batched asynchronous sector I/O
+ *
+ * Callers queue sector reads and writes in a batch, submit it and wait for
+ * its completion later, so that many requests are in flight at once. The
+ * requests go straight to the disk backend (sector_transfer), around the
+ * buffer cache: its dirty sectors are written back before a batch reads,
+ * and its copies of the sectors a batch writes are dropped by aio_wait().
+ * Backends: a pool of threads doing positional I/O, else (stdio backend,
+ * or no thread) synchronous transfers at submission. An io_uring backend
+ * is left for later: it needs liburing, which the build does not require.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "sector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AIO_DEFAULT_THREADS 4
+
+enum aio_backend {
+	AIO_SYNC,       /* transfers done by aio_submit itself */
+	AIO_THREADS     /* pool of threads */
+};
+
+struct aio_batch;
+
+struct aio_request {
+	uint32_t sector;                /* first sector */
+	uint32_t count;                 /* number of sectors */
+	void *data;                     /* count * SECTOR_SIZE bytes */
+	int write;                      /* 1: data is written, 0: data is read */
+	int error;                      /* result, set on completion */
+	struct aio_batch *batch;        /* batch of the request */
+	struct aio_request *next;       /* queue of the thread pool */
+};
+
+struct aio_batch {
+	struct aio_request *reqs;
+	size_t count;                   /* number of requests */
+	size_t capacity;                /* room in reqs */
+	size_t pending;                 /* requests submitted but not completed */
+};
+
+struct aio_engine {
+	const struct unix_filesystem *u;
+	enum aio_backend backend;
+	pthread_mutex_t lock;           /* protects the queue and pending counts */
+	pthread_cond_t work;            /* signaled when a request is queued */
+	pthread_cond_t done;            /* signaled when a request completes */
+	struct aio_request *head;       /* queue of the thread pool */
+	struct aio_request *tail;
+	int stop;                       /* the threads must exit */
+	size_t nthreads;
+	pthread_t *threads;
+};
+
+/**
+ * @brief start an I/O engine on a mounted filesystem
+ * @param u the filesystem, whose disk backend must stay the same
+ * @param threads the size of the thread pool
+ * @return a pointer to the newly created engine or NULL on failure
+ */
+struct aio_engine *aio_alloc(const struct unix_filesystem *u, unsigned int threads);
+
+/**
+ * @brief stop an I/O engine; no batch may be pending
+ * @param engine the engine to free (may be NULL)
+ */
+void aio_free(struct aio_engine *engine);
+
+/**
+ * @brief initialize an empty batch
+ * @param batch the batch (OUT)
+ */
+void aio_batch_init(struct aio_batch *batch);
+
+/**
+ * @brief release the memory of a batch that is not pending
+ * @param batch the batch
+ */
+void aio_batch_free(struct aio_batch *batch);
+
+/**
+ * @brief queue a transfer of consecutive sectors in a batch
+ * @param batch the batch, not submitted yet
+ * @param sector the first sector
+ * @param count the number of sectors (>0)
+ * @param data count * SECTOR_SIZE bytes, untouched until aio_wait() returns
+ * @param write 1 to write data to the disk, 0 to read it
+ * @return 0 on success; <0 on error
+ */
+int aio_batch_add(struct aio_batch *batch, uint32_t sector, uint32_t count,
+		  void *data, int write);
+
+/**
+ * @brief start all the transfers of a batch, without waiting for them
+ * @param engine the engine
+ * @param batch the batch
+ * @return 0 on success; <0 on error (then the batch must still be waited for)
+ */
+int aio_submit(struct aio_engine *engine, struct aio_batch *batch);
+
+/**
+ * @brief wait for all the transfers of a submitted batch
+ * @param engine the engine
+ * @param batch the batch
+ * @return 0 if all succeeded; the first error otherwise
+ */
+int aio_wait(struct aio_engine *engine, struct aio_batch *batch);
+
+#ifdef __cplusplus
+}
+#endif
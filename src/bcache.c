@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "bcache.h"
+
+
+/**
+ * @brief bucket of the hash table holding the given sector
+ */
+static struct bcache_entry **bcache_bucket(struct bcache *cache, uint32_t sector)
+{
+	return &cache->buckets[sector & (cache->nbuckets - 1)];
+}
+
+
+/**
+ * @brief find the entry holding the given sector
+ * @return the entry or NULL if the sector is not cached
+ */
+static struct bcache_entry *bcache_find(struct bcache *cache, uint32_t sector)
+{
+	struct bcache_entry *entry = *bcache_bucket(cache, sector);
+	while (entry != NULL && entry->sector != sector) {
+		entry = entry->hnext;
+	}
+	return entry;
+}
+
+
+static void lru_unlink(struct bcache *cache, struct bcache_entry *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->mru = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->lru = entry->prev;
+	}
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+
+static void lru_push_front(struct bcache *cache, struct bcache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->mru;
+	if (cache->mru) {
+		cache->mru->prev = entry;
+	} else {
+		cache->lru = entry;
+	}
+	cache->mru = entry;
+}
+
+
+static void lru_push_back(struct bcache *cache, struct bcache_entry *entry)
+{
+	entry->next = NULL;
+	entry->prev = cache->lru;
+	if (cache->lru) {
+		cache->lru->next = entry;
+	} else {
+		cache->mru = entry;
+	}
+	cache->lru = entry;
+}
+
+
+/**
+ * @brief remove an entry from the hash table and mark it reusable
+ */
+static void bcache_unhash(struct bcache *cache, struct bcache_entry *entry)
+{
+	struct bcache_entry **link = bcache_bucket(cache, entry->sector);
+	while (*link != entry) {
+		link = &(*link)->hnext;
+	}
+	*link = entry->hnext;
+	entry->hnext = NULL;
+	entry->valid = 0;
+	if (entry->dirty) {
+		entry->dirty = 0;
+		--cache->ndirty;
+	}
+}
+
+
+/**
+ * @brief the entry holding the given sector, recycling the least recently
+ *        used clean buffer if it is not cached
+ * @return the entry or NULL if the sector is not cached and all are dirty
+ */
+static struct bcache_entry *bcache_slot(struct bcache *cache, uint32_t sector)
+{
+	struct bcache_entry *entry = bcache_find(cache, sector);
+	if (entry != NULL) {
+		return entry;
+	}
+
+	entry = cache->lru;
+	while (entry != NULL && entry->dirty) {
+		entry = entry->prev;
+	}
+	if (entry == NULL) {
+		return NULL;
+	}
+	if (entry->valid) {
+		bcache_unhash(cache, entry);
+		++cache->stats.evictions;
+	}
+	entry->sector = sector;
+	entry->valid = 1;
+	struct bcache_entry **bucket = bcache_bucket(cache, sector);
+	entry->hnext = *bucket;
+	*bucket = entry;
+	return entry;
+}
+
+
+struct bcache *bcache_alloc(size_t capacity)
+{
+	// test argument
+	if (capacity == 0) {
+		return NULL;
+	}
+
+	struct bcache *cache = calloc(1, sizeof(struct bcache)
+				      + (capacity - 1) * sizeof(struct bcache_entry));
+	if (!cache) {
+		return NULL;
+	}
+
+	// twice as many buckets as entries, rounded to a power of 2
+	size_t nbuckets = 1;
+	while (nbuckets < 2 * capacity) {
+		nbuckets <<= 1;
+	}
+	cache->buckets = calloc(nbuckets, sizeof(struct bcache_entry *));
+	if (!cache->buckets) {
+		free(cache);
+		return NULL;
+	}
+	cache->capacity = capacity;
+	cache->nbuckets = nbuckets;
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_mutex_init(&cache->flush_lock, NULL);
+
+	// all entries start free, in the LRU list
+	for (size_t i = 0; i < capacity; ++i) {
+		lru_push_back(cache, &cache->entries[i]);
+	}
+
+	return cache;
+}
+
+
+void bcache_free(struct bcache *cache)
+{
+	if (!cache) {
+		return;
+	}
+	pthread_mutex_destroy(&cache->lock);
+	pthread_mutex_destroy(&cache->flush_lock);
+	free(cache->buckets);
+	free(cache);
+}
+
+
+int bcache_lookup(struct bcache *cache, uint32_t sector, void *data)
+{
+	pthread_mutex_lock(&cache->lock);
+	struct bcache_entry *entry = bcache_find(cache, sector);
+	if (entry == NULL) {
+		++cache->stats.misses;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	// move to the front of the LRU list
+	lru_unlink(cache, entry);
+	lru_push_front(cache, entry);
+
+	memcpy(data, entry->data, SECTOR_SIZE);
+	++cache->stats.hits;
+	pthread_mutex_unlock(&cache->lock);
+	return 1;
+}
+
+
+int bcache_contains(struct bcache *cache, uint32_t sector)
+{
+	pthread_mutex_lock(&cache->lock);
+	int found = bcache_find(cache, sector) != NULL;
+	pthread_mutex_unlock(&cache->lock);
+	return found;
+}
+
+
+void bcache_insert(struct bcache *cache, uint32_t sector, const void *data)
+{
+	pthread_mutex_lock(&cache->lock);
+	struct bcache_entry *entry = bcache_slot(cache, sector);
+	if (entry != NULL) {
+		lru_unlink(cache, entry);
+		lru_push_front(cache, entry);
+		// the disk is older than a dirty buffer
+		if (!entry->dirty) {
+			memcpy(entry->data, data, SECTOR_SIZE);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+int bcache_write(struct bcache *cache, uint32_t sector, const void *data, uint64_t now)
+{
+	pthread_mutex_lock(&cache->lock);
+	struct bcache_entry *entry = bcache_slot(cache, sector);
+	if (entry == NULL) {
+		pthread_mutex_unlock(&cache->lock);
+		return 1;
+	}
+
+	lru_unlink(cache, entry);
+	lru_push_front(cache, entry);
+	memcpy(entry->data, data, SECTOR_SIZE);
+	++entry->version;
+	if (!entry->dirty) {
+		entry->dirty = 1;
+		if (cache->ndirty++ == 0) {
+			cache->dirty_since = now;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+
+int bcache_must_flush(struct bcache *cache, uint64_t now)
+{
+	pthread_mutex_lock(&cache->lock);
+	int must = cache->ndirty > 0
+		   && (cache->ndirty >= cache->dirty_max
+		       || now - cache->dirty_since >= cache->dirty_age_ns);
+	pthread_mutex_unlock(&cache->lock);
+	return must;
+}
+
+
+size_t bcache_ndirty(struct bcache *cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	size_t ndirty = cache->ndirty;
+	pthread_mutex_unlock(&cache->lock);
+	return ndirty;
+}
+
+
+static int copy_sector_cmp(const void *a, const void *b)
+{
+	const struct bcache_copy *x = a;
+	const struct bcache_copy *y = b;
+	return (x->sector > y->sector) - (x->sector < y->sector);
+}
+
+
+size_t bcache_dirty(struct bcache *cache, struct bcache_copy *out, size_t max)
+{
+	size_t count = 0;
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = 0; i < cache->capacity && count < max; ++i) {
+		const struct bcache_entry *entry = &cache->entries[i];
+		if (entry->valid && entry->dirty) {
+			out[count].sector = entry->sector;
+			out[count].version = entry->version;
+			memcpy(out[count].data, entry->data, SECTOR_SIZE);
+			++count;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	qsort(out, count, sizeof(*out), copy_sector_cmp);
+	return count;
+}
+
+
+void bcache_mark_clean(struct bcache *cache, const struct bcache_copy *copies, size_t count)
+{
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = 0; i < count; ++i) {
+		// a buffer written again since its copy stays dirty
+		struct bcache_entry *entry = bcache_find(cache, copies[i].sector);
+		if (entry != NULL && entry->dirty && entry->version == copies[i].version) {
+			entry->dirty = 0;
+			--cache->ndirty;
+			++cache->stats.writebacks;
+		}
+	}
+	++cache->stats.flushes;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void bcache_invalidate(struct bcache *cache, uint32_t sector, uint32_t count)
+{
+	pthread_mutex_lock(&cache->lock);
+	for (uint32_t i = 0; i < count; ++i) {
+		struct bcache_entry *entry = bcache_find(cache, sector + i);
+		if (entry != NULL) {
+			bcache_unhash(cache, entry);
+			// free buffers are the first to be reused
+			lru_unlink(cache, entry);
+			lru_push_back(cache, entry);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void bcache_print_stats(const struct bcache *cache)
+{
+	if (!cache) {
+		printf("buffer cache disabled\n");
+		return;
+	}
+
+	printf("**********BUFFER CACHE START**********\n");
+	printf("capacity\t: %zu sectors\n", cache->capacity);
+	printf("hits\t\t: %" PRIu64 "\n", cache->stats.hits);
+	printf("misses\t\t: %" PRIu64 "\n", cache->stats.misses);
+	printf("evictions\t: %" PRIu64 "\n", cache->stats.evictions);
+	printf("dirty\t\t: %zu\n", cache->ndirty);
+	printf("writebacks\t: %" PRIu64 " sectors in %" PRIu64 " writes\n",
+	       cache->stats.writebacks, cache->stats.flushes);
+	printf("**********BUFFER CACHE END************\n");
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+/**
+ * @file bcache.h
+ * @brief buffer cache of disk sectors, sitting under sector_read/sector_write
+ *
+ * Fixed number of sector buffers, indexed by a hash table on the sector
+ * number and recycled in least-recently-used order. Written sectors may be
+ * kept dirty (write-back) until the sector layer flushes them; dirty
+ * buffers are never recycled before. Every function takes the lock of the
+ * cache, so that threads may share it; the sector layer writes the dirty
+ * buffers back one flush at a time, under flush_lock.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BCACHE_DEFAULT_SIZE 1024 /* sectors, i.e. 512 KB */
+#define BCACHE_DEFAULT_DIRTY 256 /* dirty sectors triggering a flush */
+#define BCACHE_DEFAULT_AGE_MS 5000 /* age of the oldest dirty sector triggering a flush */
+
+struct bcache_stats {
+	uint64_t hits;          /* lookups served from memory */
+	uint64_t misses;        /* lookups that had to go to disk */
+	uint64_t evictions;     /* buffers recycled to hold another sector */
+	uint64_t writebacks;    /* dirty sectors written back */
+	uint64_t flushes;       /* disk writes issued to write them back */
+};
+
+struct bcache_entry {
+	uint32_t sector;
+	int valid;
+	int dirty;                      /* newer than the disk */
+	uint64_t version;               /* number of writes to the buffer */
+	struct bcache_entry *hnext;     /* next entry in the same hash bucket */
+	struct bcache_entry *prev;      /* LRU list, towards most recently used */
+	struct bcache_entry *next;      /* LRU list, towards least recently used */
+	uint8_t data[SECTOR_SIZE];
+};
+
+/**
+ * @brief copy of a dirty buffer, written back without holding the cache
+ */
+struct bcache_copy {
+	uint32_t sector;
+	uint64_t version;               /* version of the buffer when copied */
+	uint8_t data[SECTOR_SIZE];
+};
+
+struct bcache {
+	pthread_mutex_t lock;           /* protects everything below */
+	pthread_mutex_t flush_lock;     /* held by the thread writing buffers back */
+	size_t capacity;                /* number of sector buffers */
+	size_t nbuckets;                /* size of the hash table (power of 2) */
+	struct bcache_entry **buckets;
+	struct bcache_entry *mru;       /* head of the LRU list */
+	struct bcache_entry *lru;       /* tail of the LRU list, next victim */
+	size_t ndirty;                  /* number of dirty buffers */
+	size_t dirty_max;               /* flush threshold, 0: write-through */
+	uint64_t dirty_age_ns;          /* flush when the oldest dirty buffer is that old */
+	uint64_t dirty_since;           /* when the first current dirty buffer was written */
+	struct bcache_stats stats;
+	struct bcache_entry entries[1];
+};
+
+/**
+ * @brief allocate a new buffer cache
+ * @param capacity the number of sectors it can hold (>0)
+ * @return a pointer to the newly created cache or NULL on failure
+ */
+struct bcache *bcache_alloc(size_t capacity);
+
+/**
+ * @brief release a buffer cache
+ * @param cache the cache to free (may be NULL)
+ */
+void bcache_free(struct bcache *cache);
+
+/**
+ * @brief copy a sector from the cache, if present
+ * @param cache the cache
+ * @param sector the sector number
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @return 1 on hit; 0 on miss
+ */
+int bcache_lookup(struct bcache *cache, uint32_t sector, void *data);
+
+/**
+ * @brief tell whether a sector is cached, without counting a hit or a miss
+ * @param cache the cache
+ * @param sector the sector number
+ * @return 1 if cached; 0 otherwise
+ */
+int bcache_contains(struct bcache *cache, uint32_t sector);
+
+/**
+ * @brief store the content of a sector as read from the disk, evicting the
+ *        least recently used clean one if needed (nothing is cached if all
+ *        are dirty); a dirty copy of the sector is kept as is
+ * @param cache the cache
+ * @param sector the sector number
+ * @param data a pointer to 512-bytes of memory (IN)
+ */
+void bcache_insert(struct bcache *cache, uint32_t sector, const void *data);
+
+/**
+ * @brief store the new content of a sector, to be written back later
+ * @param cache the cache
+ * @param sector the sector number
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @param now the current time in nanoseconds, for the age limit
+ * @return 0 on success; 1 if every buffer is dirty (write them back and retry)
+ */
+int bcache_write(struct bcache *cache, uint32_t sector, const void *data, uint64_t now);
+
+/**
+ * @brief tell whether the dirty buffers must be written back now
+ * @param cache the cache
+ * @param now the current time in nanoseconds
+ * @return 1 if the dirty threshold or age limit is reached; 0 otherwise
+ */
+int bcache_must_flush(struct bcache *cache, uint64_t now);
+
+/**
+ * @brief count the dirty buffers
+ * @param cache the cache
+ * @return the number of dirty buffers
+ */
+size_t bcache_ndirty(struct bcache *cache);
+
+/**
+ * @brief copy the dirty buffers, sorted by sector number
+ * @param cache the cache
+ * @param out room for max copies (OUT)
+ * @param max the number of copies out can hold
+ * @return the number of copies stored in out
+ */
+size_t bcache_dirty(struct bcache *cache, struct bcache_copy *out, size_t max);
+
+/**
+ * @brief flag buffers as written back by one disk write, unless they were
+ *        written again after being copied
+ * @param cache the cache
+ * @param copies the copies that were written to the disk
+ * @param count the number of copies
+ */
+void bcache_mark_clean(struct bcache *cache, const struct bcache_copy *copies, size_t count);
+
+/**
+ * @brief drop the given sectors from the cache, dirty or not
+ * @param cache the cache
+ * @param sector the first sector to drop
+ * @param count the number of sectors
+ */
+void bcache_invalidate(struct bcache *cache, uint32_t sector, uint32_t count);
+
+/**
+ * @brief print the hit/miss/eviction counters of a cache
+ * @param cache the cache
+ */
+void bcache_print_stats(const struct bcache *cache);
+
+#ifdef __cplusplus
+}
+#endif
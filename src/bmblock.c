@@ -91,6 +91,11 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x)
 	// set the value
 	uint64_t value = (UINT64_C(1) << elem);
 	bmblock_array->bm[index] &= ~value;
+
+	// keep the cursor at or before the first free bit
+	if (x - bmblock_array->min < bmblock_array->cursor) {
+		bmblock_array->cursor = x - bmblock_array->min;
+	}
 }
 
 
@@ -125,17 +130,213 @@ void bm_print_content(struct bmblock_array *bmblock_array)
 
 int bm_find_next(struct bmblock_array *bmblock_array)
 {
-	uint64_t index = bmblock_array->min;
-	while (bm_get(bmblock_array, index) && index <= bmblock_array->max) {
-		++index;
+	// test argument
+	M_REQUIRE_NON_NULL(bmblock_array);
+
+	// no free bit lies before the cursor (see bm_clear), start from its word
+	size_t length = bmblock_array->length;
+	size_t start = (size_t) (bmblock_array->cursor / BITS_PER_VECTOR);
+	if (start >= length) {
+		start = 0;
+	}
+	uint64_t nbits = bmblock_array->max - bmblock_array->min + 1;
+
+	// one more word than the array, to see the start word again after wrapping
+	for (size_t n = 0; n <= length; ++n) {
+		size_t index = (start + n) % length;
+		uint64_t used = bmblock_array->bm[index];
+
+		// on the first word, the bits before the cursor count as used
+		if (n == 0) {
+			used |= (UINT64_C(1) << (bmblock_array->cursor % BITS_PER_VECTOR)) - 1;
+		}
+		// bits past max are not part of the bitmap
+		if (index == length - 1 && nbits % BITS_PER_VECTOR != 0) {
+			used |= ~UINT64_C(0) << (nbits % BITS_PER_VECTOR);
+		}
+
+		if (~used != 0) {
+			uint64_t bit = index * BITS_PER_VECTOR + (uint64_t)__builtin_ctzll(~used);
+			bmblock_array->cursor = bit;
+			return (int)(bmblock_array->min + bit);
+		}
+	}
+	return ERR_BITMAP_FULL;
+}
+
+/**
+ * @brief change n bits starting at x, a 64-bit word at a time
+ */
+static void bm_change_range(struct bmblock_array *bmblock_array, uint64_t x,
+			    uint64_t n, int set)
+{
+	// test arguments
+	if (!bmblock_array || n == 0 || x < bmblock_array->min
+	    || x - bmblock_array->min + n - 1 > bmblock_array->max - bmblock_array->min) {
+		return;
+	}
+
+	uint64_t from = x - bmblock_array->min;
+	uint64_t to = from + n;
+	while (from < to) {
+		size_t index = (size_t) (from / BITS_PER_VECTOR);
+		uint64_t elem = from % BITS_PER_VECTOR;
+		uint64_t span = BITS_PER_VECTOR - elem;
+		if (span > to - from) {
+			span = to - from;
+		}
+
+		uint64_t mask = (span == BITS_PER_VECTOR) ? ~UINT64_C(0)
+				: ((UINT64_C(1) << span) - 1) << elem;
+		if (set) {
+			bmblock_array->bm[index] |= mask;
+		} else {
+			bmblock_array->bm[index] &= ~mask;
+		}
+		from += span;
+	}
+
+	// keep the cursor at or before the first free bit
+	if (!set && x - bmblock_array->min < bmblock_array->cursor) {
+		bmblock_array->cursor = x - bmblock_array->min;
+	}
+}
+
+
+void bm_set_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n)
+{
+	bm_change_range(bmblock_array, x, n, 1);
+}
+
+
+void bm_clear_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n)
+{
+	bm_change_range(bmblock_array, x, n, 0);
+}
+
+
+/**
+ * @brief offset (from min) of the first bit equal to value at or after the
+ *        offset from, scanning a word at a time
+ * @return the offset, or the number of bits of the array if there is none
+ */
+static uint64_t bm_next_bit(const struct bmblock_array *bmblock_array,
+			    uint64_t from, int value)
+{
+	uint64_t nbits = bmblock_array->max - bmblock_array->min + 1;
+	while (from < nbits) {
+		size_t index = (size_t) (from / BITS_PER_VECTOR);
+		uint64_t word = value ? bmblock_array->bm[index] : ~bmblock_array->bm[index];
+		word &= ~UINT64_C(0) << (from % BITS_PER_VECTOR);
+		if (word != 0) {
+			uint64_t bit = index * BITS_PER_VECTOR + (uint64_t)__builtin_ctzll(word);
+			return bit < nbits ? bit : nbits;
+		}
+		from = (index + 1) * BITS_PER_VECTOR;
+	}
+	return nbits;
+}
+
+
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t hint)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(bmblock_array);
+	if (n == 0) {
+		return ERR_BAD_PARAMETER;
 	}
-	if (index > bmblock_array->max) {
-		return -1;
-	} else {
-		return (int)index;
+
+	uint64_t nbits = bmblock_array->max - bmblock_array->min + 1;
+	uint64_t start = (hint >= bmblock_array->min && hint <= bmblock_array->max)
+			 ? hint - bmblock_array->min : 0;
+
+	// from the hint to the end, then from the beginning up to the hint
+	for (int pass = 0; pass < 2; ++pass) {
+		uint64_t from = pass ? 0 : start;
+		uint64_t limit = pass ? start : nbits;
+		while (from < limit) {
+			uint64_t run = bm_next_bit(bmblock_array, from, 0);
+			if (run >= limit) {
+				break;
+			}
+			uint64_t end = bm_next_bit(bmblock_array, run, 1);
+			if (end - run >= n) {
+				return (int)(bmblock_array->min + run);
+			}
+			from = end;
+		}
 	}
+	return ERR_BITMAP_FULL;
 }
 
+
+int bm_find_best_run(struct bmblock_array *bmblock_array, uint64_t n)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(bmblock_array);
+	if (n == 0) {
+		return ERR_BAD_PARAMETER;
+	}
+
+	uint64_t nbits = bmblock_array->max - bmblock_array->min + 1;
+	uint64_t best = nbits;
+	uint64_t best_length = 0;
+
+	uint64_t from = 0;
+	while (from < nbits) {
+		uint64_t run = bm_next_bit(bmblock_array, from, 0);
+		if (run >= nbits) {
+			break;
+		}
+		uint64_t end = bm_next_bit(bmblock_array, run, 1);
+		uint64_t length = end - run;
+		if (length >= n && (best_length == 0 || length < best_length)) {
+			best = run;
+			best_length = length;
+			// cannot do better than an exact fit
+			if (length == n) {
+				break;
+			}
+		}
+		from = end;
+	}
+
+	if (best_length == 0) {
+		return ERR_BITMAP_FULL;
+	}
+	return (int)(bmblock_array->min + best);
+}
+
+
+int bm_alloc_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t hint,
+		 enum bm_policy policy)
+{
+	int first = (policy == BM_BEST_FIT) ? bm_find_best_run(bmblock_array, n)
+		    : bm_find_run(bmblock_array, n, hint);
+	if (first < 0) {
+		return first;
+	}
+	bm_set_range(bmblock_array, (uint64_t)first, n);
+	return first;
+}
+
+int bm_or(struct bmblock_array *dst, const struct bmblock_array *src)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(dst);
+	M_REQUIRE_NON_NULL(src);
+	if (dst->min != src->min || dst->max != src->max) {
+		return ERR_BAD_PARAMETER;
+	}
+
+	// setting bits never frees one, so the cursor stays valid
+	for (size_t i = 0; i < dst->length; ++i) {
+		dst->bm[i] |= src->bm[i];
+	}
+	return 0;
+}
+
+
 void bm_print(struct bmblock_array *bmblock_array)
 {
 	// test argument
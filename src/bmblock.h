@@ -16,7 +16,7 @@ extern "C" {
 #endif
 
 struct bmblock_array {
-	uint64_t cursor;
+	uint64_t cursor;	/* no free bit lies before it (offset from min) */
 	uint64_t min;
 	uint64_t max;
 	size_t length;
@@ -25,6 +25,14 @@ struct bmblock_array {
 
 #define BITS_PER_VECTOR (8*sizeof(((struct bmblock_array*)0)->bm[0]))
 
+/**
+ * @brief where bm_alloc_run places a run of bits
+ */
+enum bm_policy {
+	BM_NEXT_FIT,	/* first large enough run at or after the hint */
+	BM_BEST_FIT	/* smallest large enough run of the whole bitmap */
+};
+
 /**
  * @brief allocate a new bmblock_array to handle elements indexed
  * between min and may (included, thus (max-min+1) elements).
@@ -57,12 +65,68 @@ void bm_set(struct bmblock_array *bmblock_array, uint64_t x);
 void bm_clear(struct bmblock_array *bmblock_array, uint64_t x);
 
 /**
- * @brief return the next unused bit
+ * @brief return the next unused bit, scanning a 64-bit word at a time
+ *        from the cursor (and wrapping around)
  * @param bmblock_array the array we want to search for place
  * @return <0 on failure, the value of the next unused value otherwise
  */
 int bm_find_next(struct bmblock_array *bmblock_array);
 
+/**
+ * @brief set to 1 the n bits starting at the given value
+ * @param bmblock_array the array containing the values we want to set
+ * @param x the first value of the range
+ * @param n the number of values in the range (ignored if it does not fit)
+ */
+void bm_set_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n);
+
+/**
+ * @brief set to 0 the n bits starting at the given value
+ * @param bmblock_array the array containing the values we want to clear
+ * @param x the first value of the range
+ * @param n the number of values in the range (ignored if it does not fit)
+ */
+void bm_clear_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n);
+
+/**
+ * @brief find n consecutive unused bits, next-fit: the first such run
+ *        starting at or after hint, wrapping around
+ * @param bmblock_array the array we want to search for place
+ * @param n the length of the run
+ * @param hint the value where the search starts (e.g. after the previous block of a file)
+ * @return <0 on failure, the first value of the run otherwise
+ */
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t hint);
+
+/**
+ * @brief find n consecutive unused bits, best-fit: in the smallest free
+ *        run that is large enough
+ * @param bmblock_array the array we want to search for place
+ * @param n the length of the run
+ * @return <0 on failure, the first value of the run otherwise
+ */
+int bm_find_best_run(struct bmblock_array *bmblock_array, uint64_t n);
+
+/**
+ * @brief find n consecutive unused bits according to the given policy and
+ *        mark them as used
+ * @param bmblock_array the array we want to allocate from
+ * @param n the length of the run
+ * @param hint the value where a next-fit search starts
+ * @param policy BM_NEXT_FIT or BM_BEST_FIT
+ * @return <0 on failure, the first value of the run otherwise
+ */
+int bm_alloc_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t hint,
+		 enum bm_policy policy);
+
+/**
+ * @brief merge a bitmap into another: every bit set in src is set in dst
+ * @param dst the array receiving the bits
+ * @param src an array over the same range of values as dst
+ * @return 0 on success; <0 on error
+ */
+int bm_or(struct bmblock_array *dst, const struct bmblock_array *src);
+
 /**
  * @brief usefull to see (and debug) content of a bmblock_array
  * @param bmblock_array the array we want to see
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "dcache.h"
+
+
+/**
+ * @brief bucket of the hash table holding the given name (FNV-1a)
+ */
+static struct dcache_entry **dcache_bucket(struct dcache *cache, uint16_t parent,
+					   const char *name)
+{
+	uint32_t hash = 2166136261u ^ parent;
+	for (size_t i = 0; i < DIRENT_MAXLEN && name[i] != '\0'; ++i) {
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return &cache->buckets[hash & (cache->nbuckets - 1)];
+}
+
+
+/**
+ * @brief find the entry holding the given name
+ * @return the entry or NULL if the name is not cached
+ */
+static struct dcache_entry *dcache_find(struct dcache *cache, uint16_t parent,
+					const char *name)
+{
+	struct dcache_entry *entry = *dcache_bucket(cache, parent, name);
+	while (entry != NULL
+	       && (entry->parent != parent || strncmp(entry->name, name, DIRENT_MAXLEN) != 0)) {
+		entry = entry->hnext;
+	}
+	return entry;
+}
+
+
+static void lru_unlink(struct dcache *cache, struct dcache_entry *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->mru = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->lru = entry->prev;
+	}
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+
+static void lru_push_front(struct dcache *cache, struct dcache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->mru;
+	if (cache->mru) {
+		cache->mru->prev = entry;
+	} else {
+		cache->lru = entry;
+	}
+	cache->mru = entry;
+}
+
+
+static void lru_push_back(struct dcache *cache, struct dcache_entry *entry)
+{
+	entry->next = NULL;
+	entry->prev = cache->lru;
+	if (cache->lru) {
+		cache->lru->next = entry;
+	} else {
+		cache->mru = entry;
+	}
+	cache->lru = entry;
+}
+
+
+/**
+ * @brief remove an entry from the hash table and mark it free
+ */
+static void dcache_unhash(struct dcache *cache, struct dcache_entry *entry)
+{
+	struct dcache_entry **link = dcache_bucket(cache, entry->parent, entry->name);
+	while (*link != entry) {
+		link = &(*link)->hnext;
+	}
+	*link = entry->hnext;
+	entry->hnext = NULL;
+	entry->parent = 0;
+}
+
+
+struct dcache *dcache_alloc(size_t capacity)
+{
+	// test argument
+	if (capacity == 0) {
+		return NULL;
+	}
+
+	struct dcache *cache = calloc(1, sizeof(struct dcache)
+				      + (capacity - 1) * sizeof(struct dcache_entry));
+	if (!cache) {
+		return NULL;
+	}
+
+	// twice as many buckets as entries, rounded to a power of 2
+	size_t nbuckets = 1;
+	while (nbuckets < 2 * capacity) {
+		nbuckets <<= 1;
+	}
+	cache->buckets = calloc(nbuckets, sizeof(struct dcache_entry *));
+	if (!cache->buckets) {
+		free(cache);
+		return NULL;
+	}
+	cache->capacity = capacity;
+	cache->nbuckets = nbuckets;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	// all entries start free, in the LRU list
+	for (size_t i = 0; i < capacity; ++i) {
+		lru_push_back(cache, &cache->entries[i]);
+	}
+
+	return cache;
+}
+
+
+void dcache_free(struct dcache *cache)
+{
+	if (!cache) {
+		return;
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->buckets);
+	free(cache);
+}
+
+
+int dcache_lookup(struct dcache *cache, uint16_t parent, const char *name, uint16_t *inr)
+{
+	pthread_mutex_lock(&cache->lock);
+	struct dcache_entry *entry = dcache_find(cache, parent, name);
+	if (entry == NULL) {
+		++cache->stats.misses;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	// move to the front of the LRU list
+	lru_unlink(cache, entry);
+	lru_push_front(cache, entry);
+
+	++cache->stats.hits;
+	if (entry->inr == DCACHE_NEGATIVE) {
+		++cache->stats.negative_hits;
+	}
+	*inr = entry->inr;
+	pthread_mutex_unlock(&cache->lock);
+	return 1;
+}
+
+
+void dcache_insert(struct dcache *cache, uint16_t parent, const char *name, uint16_t inr)
+{
+	// parent 0 marks the free entries
+	if (parent == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	struct dcache_entry *entry = dcache_find(cache, parent, name);
+	if (entry == NULL) {
+		// recycle the least recently used entry
+		entry = cache->lru;
+		if (entry->parent != 0) {
+			dcache_unhash(cache, entry);
+			++cache->stats.evictions;
+		}
+		entry->parent = parent;
+		strncpy(entry->name, name, DIRENT_MAXLEN);
+		entry->name[DIRENT_MAXLEN] = '\0';
+		struct dcache_entry **bucket = dcache_bucket(cache, parent, entry->name);
+		entry->hnext = *bucket;
+		*bucket = entry;
+	}
+
+	lru_unlink(cache, entry);
+	lru_push_front(cache, entry);
+	entry->inr = inr;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void dcache_invalidate_dir(struct dcache *cache, uint16_t parent)
+{
+	if (cache == NULL || parent == 0) {
+		return;
+	}
+
+	// the freed entries go to the tail, to be recycled first
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = 0; i < cache->capacity; ++i) {
+		struct dcache_entry *entry = &cache->entries[i];
+		if (entry->parent == parent) {
+			dcache_unhash(cache, entry);
+			lru_unlink(cache, entry);
+			lru_push_back(cache, entry);
+			++cache->stats.invalidations;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void dcache_print_stats(const struct dcache *cache)
+{
+	if (!cache) {
+		printf("dentry cache disabled\n");
+		return;
+	}
+
+	printf("**********DENTRY CACHE START**********\n");
+	printf("capacity\t: %zu entries\n", cache->capacity);
+	printf("hits\t\t: %" PRIu64 " (%" PRIu64 " negative)\n",
+	       cache->stats.hits, cache->stats.negative_hits);
+	printf("misses\t\t: %" PRIu64 "\n", cache->stats.misses);
+	printf("evictions\t: %" PRIu64 "\n", cache->stats.evictions);
+	printf("invalidations\t: %" PRIu64 "\n", cache->stats.invalidations);
+	printf("**********DENTRY CACHE END************\n");
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+/**
+ * @file dcache.h
+ * @brief in-core cache of directory entries, sitting under direntv6_dirlookup
+ *
+ * Maps a (parent directory inode, component name) pair to the inode of the
+ * entry, or to nothing at all: a negative entry records that the directory
+ * holds no such name, so that misses are not scanned for again. Fixed number
+ * of entries, indexed by a hash table and recycled in least-recently-used
+ * order. The entries of a directory are dropped whenever it is modified (see
+ * dcache_invalidate_dir()). Every function takes the lock of the cache, so
+ * that threads may share it.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DCACHE_DEFAULT_SIZE 512 /* entries */
+#define DCACHE_NEGATIVE 0       /* inode of a negative entry */
+
+struct dcache_stats {
+	uint64_t hits;          /* lookups answered by an entry */
+	uint64_t negative_hits; /* among them, answered "no such name" */
+	uint64_t misses;        /* lookups that had to scan the directory */
+	uint64_t evictions;     /* entries recycled to hold another name */
+	uint64_t invalidations; /* entries dropped because their directory changed */
+};
+
+struct dcache_entry {
+	uint16_t parent;                /* inode of the directory, 0 if the entry is free */
+	uint16_t inr;                   /* inode of the name, DCACHE_NEGATIVE if absent */
+	char name[DIRENT_MAXLEN + 1];
+	struct dcache_entry *hnext;     /* next entry in the same hash bucket */
+	struct dcache_entry *prev;      /* LRU list, towards most recently used */
+	struct dcache_entry *next;      /* LRU list, towards least recently used */
+};
+
+struct dcache {
+	pthread_mutex_t lock;           /* protects everything below */
+	size_t capacity;                /* number of entries */
+	size_t nbuckets;                /* size of the hash table (power of 2) */
+	struct dcache_entry **buckets;
+	struct dcache_entry *mru;       /* head of the LRU list */
+	struct dcache_entry *lru;       /* tail of the LRU list */
+	struct dcache_stats stats;
+	struct dcache_entry entries[1];
+};
+
+/**
+ * @brief allocate a new directory entry cache
+ * @param capacity the number of entries it can hold (>0)
+ * @return a pointer to the newly created cache or NULL on failure
+ */
+struct dcache *dcache_alloc(size_t capacity);
+
+/**
+ * @brief release a directory entry cache
+ * @param cache the cache to free (may be NULL)
+ */
+void dcache_free(struct dcache *cache);
+
+/**
+ * @brief look a name up in a directory
+ * @param cache the cache
+ * @param parent the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @param inr the inode of the name, DCACHE_NEGATIVE if it is absent (OUT)
+ * @return 1 if the cache knows the answer; 0 otherwise
+ */
+int dcache_lookup(struct dcache *cache, uint16_t parent, const char *name, uint16_t *inr);
+
+/**
+ * @brief record the result of a lookup, recycling the least recently used
+ *        entry if the name is not cached yet
+ * @param cache the cache
+ * @param parent the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @param inr the inode of the name, DCACHE_NEGATIVE if it is absent
+ */
+void dcache_insert(struct dcache *cache, uint16_t parent, const char *name, uint16_t inr);
+
+/**
+ * @brief drop all the entries, positive and negative, of a directory
+ * @param cache the cache (may be NULL)
+ * @param parent the inode of the modified directory
+ */
+void dcache_invalidate_dir(struct dcache *cache, uint16_t parent);
+
+/**
+ * @brief print the counters of a cache
+ * @param cache the cache
+ */
+void dcache_print_stats(const struct dcache *cache);
+
+#ifdef __cplusplus
+}
+#endif
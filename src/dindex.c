@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "dindex.h"
+#include "error.h"
+
+#define DINDEX_MIN_SLOTS 64 /* initial size of a table */
+
+
+/**
+ * @brief hash of a name (FNV-1a)
+ */
+static size_t dindex_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < DIRENT_MAXLEN && name[i] != '\0'; ++i) {
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * @brief find the index of a directory
+ * @return the index or NULL if the directory is not indexed
+ */
+static struct dindex_dir *dindex_find_dir(struct dindex *index, uint16_t dir)
+{
+	// few directories: a linear search is enough
+	for (size_t i = 0; dir != 0 && i < index->capacity; ++i) {
+		if (index->dirs[i].inr == dir) {
+			return &index->dirs[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief slot holding the given name, or the empty slot where it would go
+ */
+static struct dindex_slot *dindex_probe(const struct dindex_table *t, const char *name)
+{
+	size_t mask = t->nslots - 1;
+	size_t i = dindex_hash(name) & mask;
+	while (t->slots[i].inr != 0 && strncmp(t->slots[i].name, name, DIRENT_MAXLEN) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &t->slots[i];
+}
+
+
+/**
+ * @brief release the table of an index and mark it unused
+ */
+static void dindex_clear(struct dindex_dir *d)
+{
+	dindex_table_free(&d->table);
+	d->inr = 0;
+}
+
+
+/**
+ * @brief double the size of a table, rehashing its names
+ * @return 0 on success; ERR_NOMEM on failure (the table is left unchanged)
+ */
+static int dindex_grow(struct dindex_table *t)
+{
+	size_t nslots = t->nslots ? 2 * t->nslots : DINDEX_MIN_SLOTS;
+	struct dindex_slot *slots = calloc(nslots, sizeof(struct dindex_slot));
+	if (slots == NULL) {
+		return ERR_NOMEM;
+	}
+
+	struct dindex_table grown = *t;
+	grown.slots = slots;
+	grown.nslots = nslots;
+	for (size_t i = 0; i < t->nslots; ++i) {
+		if (t->slots[i].inr != 0) {
+			*dindex_probe(&grown, t->slots[i].name) = t->slots[i];
+		}
+	}
+	free(t->slots);
+	*t = grown;
+	return 0;
+}
+
+
+int dindex_table_add(struct dindex_table *t, const char *name, uint16_t inr)
+{
+	if (inr == 0) {
+		return 0;
+	}
+
+	// keep the table at most half full
+	if (2 * (t->count + 1) > t->nslots) {
+		int error = dindex_grow(t);
+		if (error) {
+			return error;
+		}
+	}
+
+	struct dindex_slot *slot = dindex_probe(t, name);
+	if (slot->inr == 0) {
+		slot->inr = inr;
+		strncpy(slot->name, name, DIRENT_MAXLEN);
+		++t->count;
+	}
+	return 0;
+}
+
+
+void dindex_table_free(struct dindex_table *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	t->nslots = 0;
+	t->count = 0;
+}
+
+
+struct dindex *dindex_alloc(size_t capacity)
+{
+	// test argument
+	if (capacity == 0) {
+		return NULL;
+	}
+
+	// every directory starts unused, without a table
+	struct dindex *index = calloc(1, sizeof(struct dindex)
+				      + (capacity - 1) * sizeof(struct dindex_dir));
+	if (!index) {
+		return NULL;
+	}
+	index->capacity = capacity;
+	pthread_mutex_init(&index->lock, NULL);
+	return index;
+}
+
+
+void dindex_free(struct dindex *index)
+{
+	if (!index) {
+		return;
+	}
+	for (size_t i = 0; i < index->capacity; ++i) {
+		dindex_table_free(&index->dirs[i].table);
+	}
+	pthread_mutex_destroy(&index->lock);
+	free(index);
+}
+
+
+int dindex_lookup(struct dindex *index, uint16_t dir, const char *name, uint16_t *inr)
+{
+	pthread_mutex_lock(&index->lock);
+	struct dindex_dir *d = dindex_find_dir(index, dir);
+	if (d == NULL) {
+		++index->stats.misses;
+		pthread_mutex_unlock(&index->lock);
+		return 0;
+	}
+
+	++index->stats.hits;
+	d->last_used = ++index->tick;
+	*inr = d->table.nslots ? dindex_probe(&d->table, name)->inr : 0;
+	pthread_mutex_unlock(&index->lock);
+	return 1;
+}
+
+
+int dindex_contains(struct dindex *index, uint16_t dir)
+{
+	pthread_mutex_lock(&index->lock);
+	int found = dindex_find_dir(index, dir) != NULL;
+	pthread_mutex_unlock(&index->lock);
+	return found;
+}
+
+
+void dindex_install(struct dindex *index, uint16_t dir, struct dindex_table *table)
+{
+	if (dir == 0) {
+		dindex_table_free(table);
+		return;
+	}
+
+	// replace the index of this directory, else the least recently used one
+	pthread_mutex_lock(&index->lock);
+	struct dindex_dir *d = dindex_find_dir(index, dir);
+	if (d == NULL) {
+		d = &index->dirs[0];
+		for (size_t i = 1; i < index->capacity && d->inr != 0; ++i) {
+			if (index->dirs[i].inr == 0 || index->dirs[i].last_used < d->last_used) {
+				d = &index->dirs[i];
+			}
+		}
+		if (d->inr != 0) {
+			++index->stats.evictions;
+		}
+	}
+
+	dindex_clear(d);
+	d->inr = dir;
+	d->table = *table;
+	d->last_used = ++index->tick;
+	++index->stats.builds;
+	index->stats.entries += table->count;
+	pthread_mutex_unlock(&index->lock);
+
+	// the table now belongs to the index
+	memset(table, 0, sizeof(*table));
+}
+
+
+int dindex_add(struct dindex *index, uint16_t dir, const char *name, uint16_t inr)
+{
+	if (index == NULL) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&index->lock);
+	int error = 0;
+	struct dindex_dir *d = dindex_find_dir(index, dir);
+	if (d != NULL) {
+		error = dindex_table_add(&d->table, name, inr);
+		if (error) {
+			dindex_clear(d);
+		}
+	}
+	pthread_mutex_unlock(&index->lock);
+	return error;
+}
+
+
+void dindex_remove(struct dindex *index, uint16_t dir, const char *name)
+{
+	if (index == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&index->lock);
+	struct dindex_dir *d = dindex_find_dir(index, dir);
+	struct dindex_table *t = d != NULL ? &d->table : NULL;
+	struct dindex_slot *slot = (t != NULL && t->nslots != 0) ? dindex_probe(t, name) : NULL;
+	if (slot == NULL || slot->inr == 0) {
+		pthread_mutex_unlock(&index->lock);
+		return;
+	}
+
+	// backward shift: move up the names probed past the freed slot
+	size_t mask = t->nslots - 1;
+	size_t hole = (size_t)(slot - t->slots);
+	size_t i = hole;
+	for (;;) {
+		i = (i + 1) & mask;
+		if (t->slots[i].inr == 0) {
+			break;
+		}
+		size_t home = dindex_hash(t->slots[i].name) & mask;
+		// move it unless its home lies cyclically in (hole, i]
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			t->slots[hole] = t->slots[i];
+			hole = i;
+		}
+	}
+	memset(&t->slots[hole], 0, sizeof(struct dindex_slot));
+	--t->count;
+	pthread_mutex_unlock(&index->lock);
+}
+
+
+void dindex_invalidate_dir(struct dindex *index, uint16_t dir)
+{
+	if (index == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&index->lock);
+	struct dindex_dir *d = dindex_find_dir(index, dir);
+	if (d != NULL) {
+		dindex_clear(d);
+	}
+	pthread_mutex_unlock(&index->lock);
+}
+
+
+void dindex_print_stats(const struct dindex *index)
+{
+	if (!index) {
+		printf("directory index disabled\n");
+		return;
+	}
+
+	size_t indexed = 0;
+	size_t names = 0;
+	for (size_t i = 0; i < index->capacity; ++i) {
+		if (index->dirs[i].inr != 0) {
+			++indexed;
+			names += index->dirs[i].table.count;
+		}
+	}
+
+	printf("**********DIRECTORY INDEX START**********\n");
+	printf("capacity\t: %zu directories\n", index->capacity);
+	printf("indexed\t\t: %zu directories, %zu names\n", indexed, names);
+	printf("hits\t\t: %" PRIu64 "\n", index->stats.hits);
+	printf("misses\t\t: %" PRIu64 "\n", index->stats.misses);
+	printf("builds\t\t: %" PRIu64 " (%" PRIu64 " entries)\n",
+	       index->stats.builds, index->stats.entries);
+	printf("evictions\t: %" PRIu64 "\n", index->stats.evictions);
+	printf("**********DIRECTORY INDEX END************\n");
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+/**
+ * @file dindex.h
+ * @brief in-core hash indexes of whole directories, sitting under the
+ *        dentry cache of direntv6_dirlookup
+ *
+ * The first time a directory is searched, all its entries are loaded in a
+ * hash table mapping their name to their inode, so that the next lookups
+ * in it never scan the directory again, whatever its size. A fixed number
+ * of directories are indexed at once, recycled in least-recently-used
+ * order. Creates and deletes update the index of their directory (see
+ * dindex_add() and dindex_remove()). A table is filled before it is
+ * installed, so that other threads never see a partial index; every
+ * function taking the set of indexes takes its lock.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DINDEX_DEFAULT_SIZE 16 /* directories */
+
+struct dindex_stats {
+	uint64_t hits;          /* lookups answered by an index */
+	uint64_t misses;        /* lookups in a directory not indexed */
+	uint64_t builds;        /* directories loaded in an index */
+	uint64_t entries;       /* entries loaded by these builds */
+	uint64_t evictions;     /* indexes recycled to hold another directory */
+};
+
+struct dindex_slot {
+	uint16_t inr;                   /* 0 if the slot is empty */
+	char name[DIRENT_MAXLEN];       /* not NUL-terminated if DIRENT_MAXLEN long */
+};
+
+struct dindex_table {
+	size_t count;                   /* names in the table */
+	size_t nslots;                  /* size of the table (power of 2) */
+	struct dindex_slot *slots;      /* open addressing, linear probing */
+};
+
+struct dindex_dir {
+	uint16_t inr;                   /* inode of the directory, 0 if unused */
+	struct dindex_table table;
+	uint64_t last_used;             /* tick of the last lookup */
+};
+
+struct dindex {
+	pthread_mutex_t lock;           /* protects everything below */
+	size_t capacity;                /* number of directories */
+	uint64_t tick;                  /* clock of the LRU order */
+	struct dindex_stats stats;
+	struct dindex_dir dirs[1];
+};
+
+/**
+ * @brief add a name to a table that is not installed yet; a name already
+ *        there keeps its inode, like the first match of a scan
+ * @param t the table, all zeros when empty
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @param inr the inode of the name (>0)
+ * @return 0 on success; ERR_NOMEM if the table cannot grow
+ */
+int dindex_table_add(struct dindex_table *t, const char *name, uint16_t inr);
+
+/**
+ * @brief release a table that is not installed
+ * @param t the table
+ */
+void dindex_table_free(struct dindex_table *t);
+
+/**
+ * @brief allocate a new set of directory indexes
+ * @param capacity the number of directories it can index at once (>0)
+ * @return a pointer to the newly created set or NULL on failure
+ */
+struct dindex *dindex_alloc(size_t capacity);
+
+/**
+ * @brief release a set of directory indexes
+ * @param index the set to free (may be NULL)
+ */
+void dindex_free(struct dindex *index);
+
+/**
+ * @brief look a name up in the index of a directory
+ * @param index the set of indexes
+ * @param dir the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @param inr the inode of the name, 0 if the directory does not hold it (OUT)
+ * @return 1 if the directory is indexed; 0 otherwise
+ */
+int dindex_lookup(struct dindex *index, uint16_t dir, const char *name, uint16_t *inr);
+
+/**
+ * @brief tell whether a directory is indexed, without counting a lookup
+ * @param index the set of indexes
+ * @param dir the inode of the directory
+ * @return 1 if the directory is indexed; 0 otherwise
+ */
+int dindex_contains(struct dindex *index, uint16_t dir);
+
+/**
+ * @brief make a filled table the index of a directory, replacing its
+ *        current index or else recycling the least recently used one
+ * @param index the set of indexes
+ * @param dir the inode of the directory
+ * @param table all the names of the directory; it belongs to the index
+ *        afterwards and is left empty (IN-OUT)
+ */
+void dindex_install(struct dindex *index, uint16_t dir, struct dindex_table *table);
+
+/**
+ * @brief add a name to the index of a directory, if it is indexed; a name
+ *        already there keeps its inode
+ * @param index the set of indexes (may be NULL)
+ * @param dir the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @param inr the inode of the name (>0)
+ * @return 0 on success; ERR_NOMEM if the table cannot grow (the index is then dropped)
+ */
+int dindex_add(struct dindex *index, uint16_t dir, const char *name, uint16_t inr);
+
+/**
+ * @brief remove a name from the index of a directory, if it is indexed
+ * @param index the set of indexes (may be NULL)
+ * @param dir the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ */
+void dindex_remove(struct dindex *index, uint16_t dir, const char *name);
+
+/**
+ * @brief drop the index of a directory, e.g. when it is modified in a way
+ *        the index cannot follow
+ * @param index the set of indexes (may be NULL)
+ * @param dir the inode of the directory
+ */
+void dindex_invalidate_dir(struct dindex *index, uint16_t dir);
+
+/**
+ * @brief print the counters of a set of indexes
+ * @param index the set of indexes
+ */
+void dindex_print_stats(const struct dindex *index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,11 @@
 #include "direntv6.h"
 #include "inode.h"
+#include "dcache.h"
+#include "dindex.h"
 #include "error.h"
 #include "string.h"
 #include <inttypes.h>
+#include <stdlib.h>
 
 
 #define MAXPATHLEN_UV6 1024
@@ -31,12 +34,10 @@ int direntv6_opendir(const struct unix_filesystem *u, uint16_t inr,
 	// cur and last are initialized to zero
 	d->cur 	= 0;
 	d->last = 0;
+	d->block = d->dirs;
 
-	// copy fv6 in d->fv6
-	d->fv6.offset = fv6.offset;
-	d->fv6.i_node = fv6.i_node;
-	d->fv6.i_number = fv6.i_number;
-	d->fv6.u = fv6.u;
+	// copy fv6 in d->fv6, with its block map and readahead state
+	d->fv6 = fv6;
 
 	debug_print("[OK] direntv6_opendir\n", NULL);
 	return 0;
@@ -61,31 +62,34 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 	}
 
 
-	// need to reload a block
-	if (d->cur == d->last) {
-		struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
-		int read_code = filev6_readblock(&(d->fv6), &dirs);
-		if (read_code < 0) {
-			debug_print("[--] direntv6_readdir filev6_readblock\n",
-			NULL);
-			return read_code;//Correcteur : you should return the number of blocks which is not what readblock returns
-		} else if (read_code == 0) {
-			debug_print("[OK] direntv6_readdir end of file\n", NULL);
-			d->cur = 0;
-			d->last = 0;
-			return 0;
+	for (;;) {
+		// need to reload a block
+		if (d->cur == d->last) {
+			const void *block = NULL;
+			int read_code = filev6_mapblock(&(d->fv6), d->dirs, &block);
+			if (read_code < 0) {
+				debug_print("[--] direntv6_readdir filev6_readblock\n",
+				NULL);
+				return read_code;//Correcteur : you should return the number of blocks which is not what readblock returns
+			} else if (read_code == 0) {
+				debug_print("[OK] direntv6_readdir end of file\n", NULL);
+				d->cur = 0;
+				d->last = 0;
+				return 0;
+			}
+			d->block = block;
+			d->last += DIRENTRIES_PER_SECTOR;//correcteur : coherent with your readblock but please refactor
 		}
-		memcpy(&(d->dirs), dirs, sizeof(struct direntv6) * DIRENTRIES_PER_SECTOR);
-		d->last += DIRENTRIES_PER_SECTOR;//correcteur : coherent with your readblock but please refactor
-	}
 
-	// If the inode is unallocated
-	if( d->dirs[d->cur % DIRENTRIES_PER_SECTOR].d_inumber == 0) {
-		return ERR_UNALLOCATED_INODE;
+		// free entries (removed names) are skipped
+		if (d->block[d->cur % DIRENTRIES_PER_SECTOR].d_inumber != 0) {
+			break;
+		}
+		d->cur += 1;
 	}
 
 	// copy the value to name table and check if error
-	if(strncpy(name, d->dirs[d->cur % DIRENTRIES_PER_SECTOR].d_name, DIRENT_MAXLEN)
+	if(strncpy(name, d->block[d->cur % DIRENTRIES_PER_SECTOR].d_name, DIRENT_MAXLEN)
 		== NULL)//correcteur : put a \0 at the end
 	{
 		debug_print("[--] direntv6_readdir strncpy NULL\n", NULL);
@@ -94,7 +98,7 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 	name[DIRENT_MAXLEN] = '\0';
 
 	// Initialize the last value of the table name
-	*child_inr = d->dirs[d->cur % DIRENTRIES_PER_SECTOR].d_inumber;
+	*child_inr = d->block[d->cur % DIRENTRIES_PER_SECTOR].d_inumber;
 
 	d->cur += 1;
 
@@ -103,177 +107,296 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 }
 
 
-int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const char *prefix)
+/**
+ * @brief read all the entries of a directory, free ones included, in one buffer
+ * @param u the filesystem
+ * @param inr the inode -- which must point to an allocated directory
+ * @param raw the entries, NULL if there are none, to release with free() (OUT)
+ * @param n the number of entries (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int direntv6_read_raw(const struct unix_filesystem *u, uint16_t inr,
+			     struct direntv6 **raw, size_t *n)
 {
-	// Test Pointers
-	M_REQUIRE_NON_NULL(u);
-	M_REQUIRE_NON_NULL(prefix);
-	if (inr == 0) {
-		return ERR_BAD_PARAMETER;
-	}
-
+	*raw = NULL;
+	*n = 0;
 	struct directory_reader d;
-
-
-	/**
-	 * Try to open a directory to this inode.
-	 * if unsuccessful, check if it is because it is a file or just a simple
-	 * error
-	 */
 	int error = direntv6_opendir(u, inr, &d);
 	if (error) {
-		printf("%s %s\n", SHORT_FIL_NAME, prefix);
-		return 0;
+		return error;
 	}
 
+	// the whole directory in one buffer, holes read as free entries
+	size_t count = (size_t)inode_getsize(&(d.fv6.i_node)) / sizeof(struct direntv6);
+	if (count == 0) {
+		return 0;
+	}
+	struct direntv6 *entries = malloc(count * sizeof(struct direntv6));
+	if (entries == NULL) {
+		return ERR_NOMEM;
+	}
+	int read = filev6_read(&(d.fv6), entries, (int)(count * sizeof(struct direntv6)));
+	if (read < 0) {
+		free(entries);
+		return read;
+	}
+	*raw = entries;
+	*n = (size_t)read / sizeof(struct direntv6);
+	return 0;
+}
 
 
-	// readdir
-	int return_code = 0;
-	char name[DIRENT_MAXLEN + 1];
-	char path[MAXPATHLEN_UV6];
-
-	size_t len = strlen(prefix);
-	printf("%s ", SHORT_DIR_NAME);
-	printf("%s/\n", prefix);
-
-	do {
-		uint16_t copy_inr = inr;
-
-		return_code = direntv6_readdir(&d, name, &inr);
+int direntv6_readdir_all(const struct unix_filesystem *u, uint16_t inr,
+			 struct direntv6_list *list)
+{
+	// Test the pointers
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(list);
+	list->entries = NULL;
+	list->inodes = NULL;
+	list->count = 0;
+
+	struct direntv6 *raw = NULL;
+	size_t n = 0;
+	int error = direntv6_read_raw(u, inr, &raw, &n);
+	if (error || n == 0) {
+		free(raw);
+		return error;
+	}
+	list->entries = malloc(n * sizeof(struct direntv6_entry));
+	if (list->entries == NULL) {
+		free(raw);
+		return ERR_NOMEM;
+	}
 
-		if (return_code == 1) {
-			// concatenate prefix and name in path
-			snprintf(path, MAXPATHLEN_UV6, "%s/%s", prefix, name);
-			direntv6_print_tree(u, inr, path);
-		} else if (return_code == 0) {
-			return 0;
-		} else if (return_code != ERR_UNALLOCATED_INODE) {
-			debug_print("[--] direntv6_print_tree readdir\n", NULL);
-			return return_code;
+	// pack the allocated entries
+	for (size_t i = 0; i < n; ++i) {
+		if (raw[i].d_inumber == 0) {
+			continue;
 		}
+		struct direntv6_entry *entry = &list->entries[list->count++];
+		entry->inr = raw[i].d_inumber;
+		memcpy(entry->name, raw[i].d_name, DIRENT_MAXLEN);
+		entry->name[DIRENT_MAXLEN] = '\0';
+	}
+	free(raw);
 
-		inr = copy_inr; // restore value of inr
-	} while (return_code == 1);
+	debug_print("[OK] direntv6_readdir_all %zu entries\n", list->count);
 	return 0;
 }
 
 
-int is_directory(const char* entry, size_t position)
+void direntv6_list_free(struct direntv6_list *list)
 {
-	M_REQUIRE_NON_NULL(entry);
-	// If there is not '/' after position
-	if(pos_next_entry_name(entry, &position) == 1) {
-		return 1;
+	if (list == NULL) {
+		return;
 	}
-	return 0;
+	free(list->entries);
+	free(list->inodes);
+	list->entries = NULL;
+	list->inodes = NULL;
+	list->count = 0;
 }
 
+
 /**
- * @brief	compare the name of a file to the entry path
- * @param name
- * @param entry
- * @param position
- * @return	1 if same and end of entry (file), 0 if same (directory), -1 if different
+ * @brief load the entries of a directory in its index; unlike a scan, the
+ *        free entries are skipped, not taken for the end of the directory
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param list all the entries of the directory
+ * @return 0 on success; <0 on error (the directory is then not indexed)
  */
-int entry_name_cmpr(const char* name, const char* entry, size_t position)
+static int direntv6_index_list(const struct unix_filesystem *u, uint16_t parent,
+			       const struct direntv6_list *list)
 {
-	size_t entry_length = strlen(entry);
-	size_t name_lentgth = strlen(name);
-
-	// Is not the same
-	if (name_lentgth > strlen(entry + (char)position)) {
-		return -1;
+	struct dindex_table table = { 0, 0, NULL };
+	for (size_t i = 0; i < list->count; ++i) {
+		int error = dindex_table_add(&table, list->entries[i].name, list->entries[i].inr);
+		if (error) {
+			dindex_table_free(&table);
+			return error;
+		}
 	}
+	dindex_install(u->dindex, parent, &table);
+	return 0;
+}
 
-	size_t i = 0;
-	while ((i + position) < entry_length && i < name_lentgth) {
 
-                if(entry[i + position] != name[i]) {
-			return -1;
+int direntv6_readdir_plus(const struct unix_filesystem *u, uint16_t inr,
+			  struct direntv6_list *list)
+{
+	int error = direntv6_readdir_all(u, inr, list);
+	if (error || list->count == 0) {
+		return error;
+	}
+
+	list->inodes = calloc(list->count, sizeof(struct inode));
+	uint16_t *inrs = calloc(list->count, sizeof(uint16_t));
+	int *errors = calloc(list->count, sizeof(int));
+	if (list->inodes == NULL || inrs == NULL || errors == NULL) {
+		error = ERR_NOMEM;
+	}
+	if (!error) {
+		for (size_t i = 0; i < list->count; ++i) {
+			inrs[i] = list->entries[i].inr;
+		}
+		error = inode_read_many(u, inrs, list->count, list->inodes, errors);
+	}
+	for (size_t i = 0; !error && i < list->count; ++i) {
+		if (errors[i]) {
+			memset(&list->inodes[i], 0, sizeof(struct inode));
 		}
-		++i;
+	}
+	free(inrs);
+	free(errors);
+	if (error) {
+		direntv6_list_free(list);
+		return error;
+	}
+
+	// a listing is usually followed by a lookup of each entry
+	if (u->dindex != NULL && !dindex_contains(u->dindex, inr)) {
+		(void)direntv6_index_list(u, inr, list);
+	}
+	return 0;
+}
+
+
+int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const char *prefix)
+{
+	// Test Pointers
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(prefix);
+	if (inr == 0) {
+		return ERR_BAD_PARAMETER;
 	}
 
-	// Same length and equal => it isn't a folder
-	if(strlen(entry + (char)position) == name_lentgth) {
-		return 1;
-	} else if (entry[position+i] == '/') {
+	/**
+	 * Try to read the whole directory of this inode.
+	 * if unsuccessful, check if it is because it is a file or just a simple
+	 * error
+	 */
+	struct direntv6_list list;
+	int error = direntv6_readdir_all(u, inr, &list);
+	if (error == ERR_NOMEM || error == ERR_IO) {
+		debug_print("[--] direntv6_print_tree readdir_all\n", NULL);
+		return error;
+	}
+	if (error) {
+		printf("%s %s\n", SHORT_FIL_NAME, prefix);
 		return 0;
 	}
-	return -1;
+
+	char path[MAXPATHLEN_UV6];
+	printf("%s ", SHORT_DIR_NAME);
+	printf("%s/\n", prefix);
+
+	for (size_t i = 0; i < list.count && !error; ++i) {
+		// concatenate prefix and name in path
+		snprintf(path, MAXPATHLEN_UV6, "%s/%s", prefix, list.entries[i].name);
+		error = direntv6_print_tree(u, list.entries[i].inr, path);
+	}
+	direntv6_list_free(&list);
+	return error;
 }
 
 
 /**
- * @brief	scan until it finds the begining of a new entry name
- * @param entry the entry name
- * @param position from where it begins to scan
- * @return 1 if OK, 0 if end of entry, < 0 if error
+ * @brief scan a directory for one name
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @return the inode of the name; ERR_INODE_OUTOF_RANGE if there is none;
+ *         another error <0 if the directory cannot be read
  */
-int pos_next_entry_name(const char* entry, size_t* position)
+static int direntv6_scan(const struct unix_filesystem *u, uint16_t parent,
+			 const char *name)
 {
-	// Check the paramters
-	M_REQUIRE_NON_NULL(entry);
-	M_REQUIRE_NON_NULL(position);
-        size_t entry_length = strlen(entry);
-
-	// align the position to the first '/'
-        while (entry[*position] != '/' && (entry_length > *position)) {
-		++(*position);
+	struct directory_reader d;
+	int error = direntv6_opendir(u, parent, &d);
+	if (error) {
+		return error;
 	}
 
-	// align the position to the first entry name
-	while (entry[*position] == '/' && (entry_length > *position)) {
-		++(*position);
+	// direntv6_readdir skips the free entries
+	char child[DIRENT_MAXLEN + 1];
+	uint16_t child_inr = 0;
+	int return_code = 0;
+	while ((return_code = direntv6_readdir(&d, child, &child_inr)) == 1) {
+		if (strcmp(child, name) == 0) {
+			return child_inr;
+		}
 	}
-
-	if(entry_length == *position) {
-		return 0;
-	} else {
-		return 1;
+	if (return_code == 0) {
+		return ERR_INODE_OUTOF_RANGE;
 	}
+	return return_code;
 }
 
-int direntv6_dirlookup_core(const struct unix_filesystem *u,uint16_t inr,
-	const char *entry, size_t position)
+
+/**
+ * @brief find one name in a directory, through its index if there is one
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @return the inode of the name; ERR_INODE_OUTOF_RANGE if there is none;
+ *         another error <0 if the directory cannot be read
+ */
+static int direntv6_search(const struct unix_filesystem *u, uint16_t parent,
+			   const char *name)
 {
-	M_REQUIRE_NON_NULL(u);
-	M_REQUIRE_NON_NULL(entry);
-	if (inr == 0) {
-		return ERR_BAD_PARAMETER;
+	if (u->dindex == NULL) {
+		return direntv6_scan(u, parent, name);
 	}
 
-	struct directory_reader d;
+	// the first search of a directory loads its index
+	uint16_t inr = 0;
+	if (!dindex_lookup(u->dindex, parent, name, &inr)) {
+		struct direntv6_list list;
+		int error = direntv6_readdir_all(u, parent, &list);
+		if (!error) {
+			error = direntv6_index_list(u, parent, &list);
+			direntv6_list_free(&list);
+		}
+		if (error == ERR_NOMEM) {
+			return direntv6_scan(u, parent, name);
+		}
+		if (error) {
+			return error;
+		}
+		dindex_lookup(u->dindex, parent, name, &inr);
+	}
+	return inr != 0 ? inr : ERR_INODE_OUTOF_RANGE;
+}
 
-	int error = direntv6_opendir(u, inr, &d);
-	if (error){
-		return error;
+
+/**
+ * @brief find one name in a directory, through the dentry cache
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @return the inode of the name; <0 on error
+ */
+static int direntv6_lookup_name(const struct unix_filesystem *u, uint16_t parent,
+				const char *name)
+{
+	uint16_t inr = 0;
+	if (u->dcache != NULL && dcache_lookup(u->dcache, parent, name, &inr)) {
+		return inr == DCACHE_NEGATIVE ? ERR_INODE_OUTOF_RANGE : inr;
 	}
 
-	int return_code = 0;
-        int r_inode = 0;
-	char name[DIRENT_MAXLEN + 1];
-	do {
-		uint16_t copy_inr = inr; // save inr value in case of error
-		return_code = direntv6_readdir(&d, name, &inr);
-                if (return_code == 1) {
-			// if same name and folder
-			if(entry_name_cmpr(name, entry, position) == 0) {
-				pos_next_entry_name(entry, &position);
-				r_inode = direntv6_dirlookup_core(u, inr, entry, position);
-				if (r_inode > 0) {
-					return r_inode;
-				}
-			} else if (entry_name_cmpr(name, entry, position) == 1) {
-				return inr;
-			}
-		} else {
-			inr = copy_inr; // restore value of inr
-		}
-	} while (return_code == 1);
+	int found = direntv6_search(u, parent, name);
 
-	return ERR_INODE_OUTOF_RANGE;
+	// remember the answer, the absence of the name as well
+	if (u->dcache != NULL) {
+		if (found > 0) {
+			dcache_insert(u->dcache, parent, name, (uint16_t)found);
+		} else if (found == ERR_INODE_OUTOF_RANGE) {
+			dcache_insert(u->dcache, parent, name, DCACHE_NEGATIVE);
+		}
+	}
+	return found;
 }
 
 
@@ -287,77 +410,253 @@ int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr,
 		return ERR_BAD_PARAMETER;
 	}
 
-	size_t position = 0;
-        int return_code = 1;
-	// check if need to align position
-        if (entry[0] == '/') {
-		return_code = pos_next_entry_name(entry, &position);//correcteur : do that only once in lookup core
-	}
-	if(return_code == 0) {
-		return inr;
-	} else if (return_code < 0) {
-		return return_code;
-	}
+	// resolve the path one component at a time
+	int current = inr;
+	const char *cursor = entry;
+	for (;;) {
+		while (*cursor == '/') {
+			++cursor;
+		}
+		if (*cursor == '\0') {
+			return current;
+		}
 
-        return direntv6_dirlookup_core(u, inr, entry, position);
+		size_t length = strcspn(cursor, "/");
+		if (length > DIRENT_MAXLEN) {
+			return ERR_INODE_OUTOF_RANGE;
+		}
+		char name[DIRENT_MAXLEN + 1];
+		memcpy(name, cursor, length);
+		name[length] = '\0';
+
+		int child = direntv6_lookup_name(u, (uint16_t)current, name);
+		// a file in the middle of the path: no such entry
+		if (child == ERR_INVALID_DIRECTORY_INODE && current != inr) {
+			return ERR_INODE_OUTOF_RANGE;
+		}
+		if (child < 0) {
+			return child;
+		}
+		current = child;
+		cursor += length;
+	}
 }
 
 
 /**
- *  Test if the inode is available given the path
- * @param u
- * @param entry
- * @return
+ * @brief split a path into the directory holding it and its last component
+ * @param u the filesystem
+ * @param entry the full path of the entry
+ * @param rel_name its last component, DIRENT_MAXLEN+1 bytes (OUT)
+ * @param parent_inr the inode of the directory that holds it (OUT)
+ * @return 0 on success; <0 on error
  */
-int existence_control (struct unix_filesystem *u, const char *entry, char* rel_name, uint16_t *parent_inr)
+static int direntv6_split(const struct unix_filesystem *u, const char *entry,
+			  char *rel_name, uint16_t *parent_inr)
 {
 	// Test arguments
 	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(entry);
 	M_REQUIRE_NON_NULL(rel_name);
+	M_REQUIRE_NON_NULL(parent_inr);
 
+	// the relative name follows the last '/'
 	size_t entry_length = strlen(entry);
-	// Test length of entry
-	if (entry_length <= strlen(ROOTDIR_NAME)) {
-		return ERR_FILENAME_ALREADY_EXISTS;
+	while (entry_length > 1 && entry[entry_length - 1] == '/') {
+		--entry_length;
 	}
-
-	// Find the beginning of the relative name
 	size_t beg_rel_name = entry_length;
-	while (entry[beg_rel_name] != '/' && beg_rel_name > 0) {
-		-- beg_rel_name;
+	while (beg_rel_name > 0 && entry[beg_rel_name - 1] != '/') {
+		--beg_rel_name;
 	}
-
-	// If there's no '/'
-	if (beg_rel_name == 0) {
-		return ERR_BAD_PARAMETER;
+	size_t name_length = entry_length - beg_rel_name;
+	if (name_length == 0) {
+		return ERR_FILENAME_ALREADY_EXISTS;
 	}
-	// position after the '/'
-	++ beg_rel_name;
-	if (strlen(entry + beg_rel_name) > FILENAME_MAX) {
+	if (name_length > DIRENT_MAXLEN) {
 		return ERR_FILENAME_TOO_LONG;
 	}
+	if (entry_length >= MAXPATHLEN_UV6) {
+		return ERR_BAD_PARAMETER;
+	}
 
-	char *parent_name = malloc(beg_rel_name -1);
-	// Create parent name
-	memcpy(parent_name,entry_length,beg_rel_name - 2);
-	parent_name[beg_rel_name] = '\0';
+	// the parent must be an existing directory
+	// (without its trailing '/', but the root)
+	size_t parent_length = beg_rel_name;
+	while (parent_length > 1 && entry[parent_length - 1] == '/') {
+		--parent_length;
+	}
+	char parent_name[MAXPATHLEN_UV6];
+	memcpy(parent_name, entry, parent_length);
+	parent_name[parent_length] = '\0';
+	int parent = direntv6_dirlookup(u, ROOT_INUMBER, parent_name);
+	if (parent < 0) {
+		return parent;
+	}
+	struct inode inode;
+	int error = inode_read(u, (uint16_t)parent, &inode);
+	if (error) {
+		return error;
+	}
+	if ((inode.i_mode & IFMT) != IFDIR) {
+		return ERR_INVALID_DIRECTORY_INODE;
+	}
 
-	// Test if parent exists
-	*parent_inr = direntv6_dirlookup(u, ROOT_INUMBER, parent_name);
-	if (*parent_inr < 0) {
-		return *parent_inr;
+	memcpy(rel_name, entry + beg_rel_name, name_length);
+	rel_name[name_length] = '\0';
+	*parent_inr = (uint16_t)parent;
+	return 0;
+}
+
+
+/**
+ * @brief check that a new entry can be created at the given path
+ * @param u the filesystem
+ * @param entry the full path of the new entry
+ * @param rel_name its last component, DIRENT_MAXLEN+1 bytes (OUT)
+ * @param parent_inr the inode of the directory that will hold it (OUT)
+ * @return 0 if it can; <0 on error
+ */
+static int existence_control(const struct unix_filesystem *u, const char *entry,
+			     char *rel_name, uint16_t *parent_inr)
+{
+	int error = direntv6_split(u, entry, rel_name, parent_inr);
+	if (error) {
+		return error;
 	}
 
-	// Test if full path does not exists
-	int i_numb = direntv6_dirlookup(u,ROOT_INUMBER, parent_name);
-	if (i_numb > 0) {
+	// the full path must not exist yet
+	if (direntv6_lookup_name(u, *parent_inr, rel_name) >= 0) {
 		return ERR_FILENAME_ALREADY_EXISTS;
 	}
+	return 0;
+}
+
+
+/**
+ * @brief find where an entry of a directory is
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param name the component to find; NULL for the first free entry
+ * @param offset the offset of the entry in the directory, its size if
+ *        there is no free entry (OUT)
+ * @return the inode of the name (0 for a free entry); ERR_INODE_OUTOF_RANGE
+ *         if there is none; another error <0 if the directory cannot be read
+ */
+static int direntv6_find_slot(const struct unix_filesystem *u, uint16_t parent,
+			      const char *name, int32_t *offset)
+{
+	struct direntv6 *raw = NULL;
+	size_t n = 0;
+	int error = direntv6_read_raw(u, parent, &raw, &n);
+	if (error) {
+		return error;
+	}
+
+	int found = (name == NULL) ? 0 : ERR_INODE_OUTOF_RANGE;
+	*offset = (int32_t)(n * sizeof(struct direntv6));
+	for (size_t i = 0; i < n; ++i) {
+		int match = (name == NULL) ? raw[i].d_inumber == 0
+			    : raw[i].d_inumber != 0 && strncmp(raw[i].d_name, name, DIRENT_MAXLEN) == 0;
+		if (match) {
+			found = raw[i].d_inumber;
+			*offset = (int32_t)(i * sizeof(struct direntv6));
+			break;
+		}
+	}
+	free(raw);
+	return found;
+}
 
-	// Copy the relative name
-	strncpy(rel_name, entry+beg_rel_name+1,FILENAME_MAX);
 
+/**
+ * @brief write an entry of a directory, or append it at its end
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param offset where the entry goes, the size of the directory to append it
+ * @param name its name; NULL to free the entry
+ * @param inr its inode; 0 to free the entry
+ * @return 0 on success; <0 on error
+ */
+static int direntv6_write_slot(struct unix_filesystem *u, uint16_t parent,
+			       int32_t offset, const char *name, uint16_t inr)
+{
+	struct direntv6 dir;
+	memset(&dir, 0, sizeof(dir));
+	dir.d_inumber = inr;
+	if (name != NULL) {
+		strncpy(dir.d_name, name, DIRENT_MAXLEN);
+	}
+
+	struct filev6 fv6;
+	int error = filev6_open(u, parent, &fv6);
+	if (!error) {
+		error = filev6_lseek(&fv6, offset);
+	}
+	if (!error) {
+		error = filev6_write(u, &fv6, &dir, sizeof(dir));
+	}
+	// even a partial write changes what the parent holds
+	dcache_invalidate_dir(u->dcache, parent);
+	return error < 0 ? error : 0;
+}
+
+
+/**
+ * @brief add a name to a directory, in its first free entry or else at its
+ *        end, keeping its index up to date
+ * @param u the filesystem
+ * @param parent the inode of the directory
+ * @param name the component, at most DIRENT_MAXLEN characters
+ * @param inr the inode of the name
+ * @return 0 on success; <0 on error
+ */
+static int direntv6_add_entry(struct unix_filesystem *u, uint16_t parent,
+			      const char *name, uint16_t inr)
+{
+	int32_t offset = 0;
+	int error = direntv6_find_slot(u, parent, NULL, &offset);
+	if (error >= 0) {
+		error = direntv6_write_slot(u, parent, offset, name, inr);
+	}
+	if (error < 0) {
+		dindex_invalidate_dir(u->dindex, parent);
+		return error;
+	}
+	// drops the index by itself if it cannot grow
+	(void)dindex_add(u->dindex, parent, name, inr);
+	return 0;
+}
+
+
+/**
+ * @brief free an inode that no entry names any more, with its blocks
+ * @param u the filesystem
+ * @param inr the inode
+ * @return 0 on success; <0 on error
+ */
+static int direntv6_free_inode(struct unix_filesystem *u, uint16_t inr)
+{
+	struct filev6 fv6;
+	int error = filev6_open(u, inr, &fv6);
+	if (!error) {
+		error = filev6_truncate(u, &fv6, 0);
+	}
+	if (error) {
+		return error;
+	}
+
+	struct inode inode;
+	memset(&inode, 0, sizeof(inode));
+	error = inode_write(u, inr, &inode);
+	if (error) {
+		return error;
+	}
+	bm_clear(u->ibm, inr);
+
+	// a directory may come back under this inode
+	dcache_invalidate_dir(u->dcache, inr);
+	dindex_invalidate_dir(u->dindex, inr);
 	return 0;
 }
 
@@ -368,12 +667,12 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
 	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(entry);
 
-	char *rel_name = calloc(FILENAME_MAX, 1);
-	uint16_t parent_inr;
+	char rel_name[DIRENT_MAXLEN + 1];
+	uint16_t parent_inr = 0;
 
 	// Test if path available
 	int return_code = existence_control(u, entry, rel_name, &parent_inr);
-	if (return_code != 1) {
+	if (return_code < 0) {
 		return return_code;
 	}
 
@@ -382,32 +681,199 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
 		return inr;
 	}
 
-	// Create filev6 and initialize it
+	// Create the inode of the new entry
 	struct filev6 fv6;
-	return_code = filev6_open(u, inr, &fv6);
-	if (return_code < 0) {
-		return  return_code;
+	memset(&fv6, 0, sizeof(fv6));
+	fv6.u = u;
+	fv6.i_number = (uint16_t)inr;
+	return_code = filev6_create(u, (uint16_t)(mode | IALLOC), &fv6);
+
+	// Add the direntv6 corresponding to the inode to its parent
+	if (!return_code) {
+		return_code = direntv6_add_entry(u, parent_inr, rel_name, (uint16_t)inr);
 	}
-	return_code = filev6_create(u, mode, &fv6);
 	if (return_code < 0) {
+		// the new inode has no block yet: it is only unallocated again,
+		// on disk first (if that fails, the bit stays set: lost, not reused)
+		struct inode inode;
+		memset(&inode, 0, sizeof(inode));
+		if (inode_write(u, (uint16_t)inr, &inode) == 0) {
+			bm_clear(u->ibm, (uint64_t)inr);
+		}
 		return return_code;
 	}
 
-	// Create direntv6 corresponding to the inode
-	struct direntv6 dir = {};
-	dir.d_inumber = inr;
-	strncpy(&(dir.d_name), rel_name, FILENAME_MAX);
+	debug_print("[OK] direntv6_create %s: #%d\n", entry, inr);
+	return inr;
+}
 
-	// filev6 containing parent
-	return_code = filev6_open(u, parent_inr, &fv6);
-	if (return_code < 0) {
-		return return_code;
+
+/**
+ * @brief remove the entry of a file or of an empty directory, freeing its inode
+ * @param u the filesystem
+ * @param entry the path of the entry
+ * @param dir 1 if the entry must be a directory, 0 if it must not
+ * @return 0 on success; <0 on error
+ */
+static int direntv6_remove(struct unix_filesystem *u, const char *entry, int dir)
+{
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(entry);
+
+	char rel_name[DIRENT_MAXLEN + 1];
+	uint16_t parent_inr = 0;
+	int error = direntv6_split(u, entry, rel_name, &parent_inr);
+	if (error) {
+		return error == ERR_FILENAME_ALREADY_EXISTS ? ERR_BAD_PARAMETER : error;
+	}
+	int32_t offset = 0;
+	int inr = direntv6_find_slot(u, parent_inr, rel_name, &offset);
+	if (inr < 0) {
+		return inr;
 	}
 
-	printf("direntv6_create not finished\n");
+	// the kind of entry must match, a directory must be empty
+	struct inode inode;
+	error = inode_read(u, (uint16_t)inr, &inode);
+	if (error) {
+		return error;
+	}
+	int is_dir = (inode.i_mode & IFMT) == IFDIR;
+	if (is_dir && !dir) {
+		return ERR_IS_A_DIRECTORY;
+	}
+	if (!is_dir && dir) {
+		return ERR_INVALID_DIRECTORY_INODE;
+	}
+	if (is_dir) {
+		struct direntv6_list list;
+		error = direntv6_readdir_all(u, (uint16_t)inr, &list);
+		size_t count = list.count;
+		direntv6_list_free(&list);
+		if (error) {
+			return error;
+		}
+		if (count > 0) {
+			return ERR_DIRECTORY_NOT_EMPTY;
+		}
+	}
 
-	free(rel_name);
-	rel_name = NULL;
+	// the name goes first, then the inode nothing names any more
+	error = direntv6_write_slot(u, parent_inr, offset, NULL, 0);
+	if (error) {
+		dindex_invalidate_dir(u->dindex, parent_inr);
+		return error;
+	}
+	dindex_remove(u->dindex, parent_inr, rel_name);
 
-	return 0;
+	debug_print("[OK] direntv6_remove %s: #%d\n", entry, inr);
+	return direntv6_free_inode(u, (uint16_t)inr);
+}
+
+
+int direntv6_unlink(struct unix_filesystem *u, const char *entry)
+{
+	return direntv6_remove(u, entry, 0);
+}
+
+
+int direntv6_rmdir(struct unix_filesystem *u, const char *entry)
+{
+	return direntv6_remove(u, entry, 1);
+}
+
+
+int direntv6_rename(struct unix_filesystem *u, const char *from, const char *to)
+{
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(from);
+	M_REQUIRE_NON_NULL(to);
+
+	// a directory cannot move below itself
+	size_t from_length = strlen(from);
+	if (strncmp(from, to, from_length) == 0 && to[from_length] == '/') {
+		return ERR_BAD_PARAMETER;
+	}
+
+	char from_name[DIRENT_MAXLEN + 1];
+	char to_name[DIRENT_MAXLEN + 1];
+	uint16_t from_parent = 0;
+	uint16_t to_parent = 0;
+	int error = direntv6_split(u, from, from_name, &from_parent);
+	if (!error) {
+		error = direntv6_split(u, to, to_name, &to_parent);
+	}
+	if (error) {
+		return error == ERR_FILENAME_ALREADY_EXISTS ? ERR_BAD_PARAMETER : error;
+	}
+
+	int32_t from_offset = 0;
+	int inr = direntv6_find_slot(u, from_parent, from_name, &from_offset);
+	if (inr < 0) {
+		return inr;
+	}
+	int32_t to_offset = 0;
+	int target = direntv6_find_slot(u, to_parent, to_name, &to_offset);
+	if (target == inr) {
+		return 0;
+	}
+	if (target < 0 && target != ERR_INODE_OUTOF_RANGE) {
+		return target;
+	}
+
+	// an existing target is replaced by an entry of the same kind
+	if (target > 0) {
+		struct inode source;
+		struct inode victim;
+		error = inode_read(u, (uint16_t)inr, &source);
+		if (!error) {
+			error = inode_read(u, (uint16_t)target, &victim);
+		}
+		if (error) {
+			return error;
+		}
+		int source_dir = (source.i_mode & IFMT) == IFDIR;
+		int victim_dir = (victim.i_mode & IFMT) == IFDIR;
+		if (victim_dir && !source_dir) {
+			return ERR_IS_A_DIRECTORY;
+		}
+		if (!victim_dir && source_dir) {
+			return ERR_INVALID_DIRECTORY_INODE;
+		}
+		if (victim_dir) {
+			struct direntv6_list list;
+			error = direntv6_readdir_all(u, (uint16_t)target, &list);
+			size_t count = list.count;
+			direntv6_list_free(&list);
+			if (error) {
+				return error;
+			}
+			if (count > 0) {
+				return ERR_DIRECTORY_NOT_EMPTY;
+			}
+		}
+
+		error = direntv6_write_slot(u, to_parent, to_offset, to_name, (uint16_t)inr);
+		dindex_remove(u->dindex, to_parent, to_name);
+		if (!error) {
+			error = dindex_add(u->dindex, to_parent, to_name, (uint16_t)inr);
+		}
+	} else {
+		error = direntv6_add_entry(u, to_parent, to_name, (uint16_t)inr);
+	}
+	if (error) {
+		dindex_invalidate_dir(u->dindex, to_parent);
+		return error;
+	}
+
+	// the new name is there: the old one can go
+	error = direntv6_write_slot(u, from_parent, from_offset, NULL, 0);
+	if (error) {
+		dindex_invalidate_dir(u->dindex, from_parent);
+		return error;
+	}
+	dindex_remove(u->dindex, from_parent, from_name);
+
+	debug_print("[OK] direntv6_rename %s -> %s: #%d\n", from, to, inr);
+	return target > 0 ? direntv6_free_inode(u, (uint16_t)target) : 0;
 }
@@ -20,10 +20,28 @@ extern "C" {
 struct directory_reader {
     struct filev6 fv6;
     struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+    const struct direntv6 *block;	// current sector of entries: dirs or the mapped disk
     int cur;	// pos of current fils
     int last;	// pos of last read fils from disk file
 };
 
+/**
+ * @brief an entry of a directory listing
+ */
+struct direntv6_entry {
+    uint16_t inr;	// inode of the entry
+    char name[DIRENT_MAXLEN + 1];	// NUL-terminated name
+};
+
+/**
+ * @brief all the entries of a directory; see direntv6_readdir_all()
+ */
+struct direntv6_list {
+    struct direntv6_entry *entries;	// packed array, NULL if empty
+    struct inode *inodes;	// inodes of the entries, NULL unless read by direntv6_readdir_plus()
+    size_t count;	// number of entries
+};
+
 /**
  * @brief opens a directory reader for the specified inode 'inr'
  * @param u the mounted filesystem
@@ -34,7 +52,7 @@ struct directory_reader {
 int direntv6_opendir(const struct unix_filesystem *u, uint16_t inr, struct directory_reader *d);
 
 /**
- * @brief return the next directory entry.
+ * @brief return the next directory entry, skipping the free ones.
  * @param d the dierctory reader
  * @param name pointer to at least DIRENTMAX_LEN+1 bytes.  Filled in with the NULL-terminated string of the entry (OUT)
  * @param child_inr pointer to the inode number in the entry (OUT)
@@ -42,6 +60,35 @@ int direntv6_opendir(const struct unix_filesystem *u, uint16_t inr, struct direc
  */
 int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr);
 
+/**
+ * @brief read all the entries of a directory at once: one vectored read per
+ *        extent of the directory, then a single pass over its entries; the
+ *        free entries are skipped, wherever they are
+ * @param u the mounted filesystem
+ * @param inr the inode -- which must point to an allocated directory
+ * @param list the entries, to release with direntv6_list_free() (OUT)
+ * @return 0 on success; <0 on error
+ */
+int direntv6_readdir_all(const struct unix_filesystem *u, uint16_t inr, struct direntv6_list *list);
+
+/**
+ * @brief same as direntv6_readdir_all, with the inodes of the entries as
+ *        well, read with one access per sector of the inode table; the
+ *        directory gets indexed on the way, for the lookups that follow
+ * @param u the mounted filesystem
+ * @param inr the inode -- which must point to an allocated directory
+ * @param list the entries and their inodes, an unreadable one being all
+ *        zeros; to release with direntv6_list_free() (OUT)
+ * @return 0 on success; <0 on error
+ */
+int direntv6_readdir_plus(const struct unix_filesystem *u, uint16_t inr, struct direntv6_list *list);
+
+/**
+ * @brief release the entries of a directory listing
+ * @param list the listing (may be NULL)
+ */
+void direntv6_list_free(struct direntv6_list *list);
+
 /**
  * @brief debugging routine; print the a subtree (note: recursive)
  * @param u a mounted filesystem
@@ -52,7 +99,8 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const char *prefix);
 
 /**
- * @brief get the inode number for the given path
+ * @brief get the inode number for the given path, resolved one component at
+ *        a time through the dentry cache of the filesystem
  * @param u a mounted filesystem
  * @param inr the current of the subtree
  * @param entry the prefix to the subtree
@@ -61,14 +109,42 @@ int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const cha
 int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char *entry);
 
 /**
- * @brief create a new direntv6 with the given name and given mode
+ * @brief create a new direntv6 with the given name and given mode, its entry
+ *        going to the first free entry of the parent directory or at its end
  * @param u a mounted filesystem
  * @param entry the path of the new entry
- * @param mode the mode of the new inode
+ * @param mode the mode of the new inode (IALLOC is added)
  * @return inr on success; <0 on error
  */
 int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode);
 
+/**
+ * @brief remove the entry of a file, freeing its inode and blocks
+ * @param u a mounted filesystem
+ * @param entry the path of the file
+ * @return 0 on success; ERR_IS_A_DIRECTORY if it is a directory; <0 on error
+ */
+int direntv6_unlink(struct unix_filesystem *u, const char *entry);
+
+/**
+ * @brief remove the entry of an empty directory, freeing its inode and blocks
+ * @param u a mounted filesystem
+ * @param entry the path of the directory
+ * @return 0 on success; ERR_DIRECTORY_NOT_EMPTY if it has entries; <0 on error
+ */
+int direntv6_rmdir(struct unix_filesystem *u, const char *entry);
+
+/**
+ * @brief move an entry to another path, in the same directory or not; an
+ *        entry of the same kind at the new path is replaced (a directory
+ *        only if it is empty)
+ * @param u a mounted filesystem
+ * @param from the path of the entry
+ * @param to its new path
+ * @return 0 on success; <0 on error
+ */
+int direntv6_rename(struct unix_filesystem *u, const char *from, const char *to);
+
 #ifdef __cplusplus
 }
 #endif
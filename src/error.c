@@ -17,5 +17,8 @@ const char * const ERR_MESSAGES[] = {
     "file too large",
     "offset out of range",
     "bad parameter",
-    "not enough sectors for inodes"
+    "not enough sectors for inodes",
+    "read-only filesystem",
+    "directory not empty",
+    "is a directory"
 };
@@ -3,6 +3,79 @@
 #include "inode.h"
 #include "sector.h"
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "bmblock.h"
+
+#define READAHEAD_MIN 4 /* first readahead window of a sequential access, in sectors */
+
+/**
+ * @brief forget the access pattern of a file
+ */
+static void filev6_ra_reset(struct filev6 *fv6)
+{
+	fv6->ra.expected = 0;
+	fv6->ra.window = 0;
+	fv6->ra.ahead = 0;
+}
+
+
+/**
+ * @brief detect sequential access and bring the next sectors of the file in
+ *        memory, doubling the window at each sequential read up to the limit
+ *        of the mount; errors are ignored, the reads will report them.
+ *        The prefetch is synchronous, in the thread of the read: it turns
+ *        many small reads into a few large ones, it does not overlap them
+ * @param fv6 the file
+ * @param start the offset the last read started at
+ * @param end the offset it stopped at
+ */
+static void filev6_readahead(struct filev6 *fv6, int32_t start, int32_t end)
+{
+	struct filev6_readahead *ra = &(fv6->ra);
+	int32_t max = fv6->u->readahead_max;
+	int sequential = (start == ra->expected);
+	ra->expected = end;
+	if (max <= 0 || !sequential) {
+		ra->window = 0;
+		ra->ahead = 0;
+		return;
+	}
+
+	ra->window = (ra->window == 0) ? READAHEAD_MIN : 2 * ra->window;
+	if (ra->window > max) {
+		ra->window = max;
+	}
+
+	// the window follows the read, without going past the end of file
+	int32_t from = end / SECTOR_SIZE;
+	if (from < ra->ahead) {
+		from = ra->ahead;
+	}
+	int32_t to = end / SECTOR_SIZE + ra->window;
+	int32_t sectors = (inode_getsize(&(fv6->i_node)) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	if (to > sectors) {
+		to = sectors;
+	}
+	if (from >= to) {
+		return;
+	}
+
+	// one batch per extent, holes have nothing to read
+	struct inode_extent_iter iter;
+	struct inode_extent extent;
+	if (inode_extents_begin(fv6->u, &(fv6->i_node), &(fv6->map), from, to - from, &iter)) {
+		return;
+	}
+	while (inode_extent_next(&iter, &extent) == 1) {
+		if (extent.physical != 0
+		    && sector_prefetch(fv6->u, extent.physical, (uint32_t)extent.length)) {
+			return;
+		}
+	}
+	ra->ahead = to;
+}
+
 
 int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv6)
 {
@@ -14,6 +87,8 @@ int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv
 	fv6->u = u;
 	fv6->offset = 0;
 	fv6->i_number = inr;
+	fv6->map.slot = INODE_MAP_EMPTY;
+	filev6_ra_reset(fv6);
 
 	// load the inode
 	int error = inode_read(u, inr, &(fv6->i_node));
@@ -28,11 +103,25 @@ int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv
 
 
 int filev6_readblock(struct filev6 *fv6, void *buf)
+{
+	const void *block = NULL;
+	int read_bytes = filev6_mapblock(fv6, buf, &block);
+	// the caller wants its own copy
+	if (read_bytes > 0 && block != buf) {
+		memcpy(buf, block, SECTOR_SIZE);
+	}
+	return read_bytes;
+}
+
+
+int filev6_mapblock(struct filev6 *fv6, void *buf, const void **block)
 {
 	// Test for NULL pointer
 	M_REQUIRE_NON_NULL(fv6);
 	M_REQUIRE_NON_NULL(buf);
+	M_REQUIRE_NON_NULL(block);
 	M_REQUIRE_NON_NULL(fv6->u);
+	*block = buf;
 
 	// Get the size of the file and the size of the offset 
 	int32_t size = inode_getsize(&(fv6->i_node));
@@ -52,24 +141,124 @@ int filev6_readblock(struct filev6 *fv6, void *buf)
 	}
 
 	// Load the offset of the sector
-	int sect = inode_findsector(fv6->u, &(fv6->i_node), (fv6->offset)/SECTOR_SIZE);
-	if (sect < 0 ) {
+	uint16_t sect = 0;
+	int error = inode_map_range(fv6->u, &(fv6->i_node), &(fv6->map),
+				    (fv6->offset)/SECTOR_SIZE, 1, &sect);
+	if (error) {
 		debug_print("[--] filev6_readblock error searching offset", NULL);
-		return sect;
+		return error;
 	}
 
-	int error = sector_read(fv6->u->f, (uint16_t)sect, buf);
-	if (error) {
-		debug_print("[--] filev6_readblock error sector_read", NULL);
-		return error;	
+	// no copy at all when the disk is memory-mapped
+	const void *mapped = sector_map(fv6->u, sect);
+	if (mapped != NULL) {
+		*block = mapped;
+	} else {
+		error = sector_read(fv6->u, sect, buf);
+		if (error) {
+			debug_print("[--] filev6_readblock error sector_read", NULL);
+			return error;	
+		}
 	}
 	
 	fv6->offset += SECTOR_SIZE;
+	filev6_readahead(fv6, offset_size, fv6->offset);
 	
 	
 	return SECTOR_SIZE;
 }
 
+/**
+ * @brief read one run of physically contiguous sectors with a single
+ *        vectored read: the bytes before pos and after pos+want within the
+ *        run land in scratch buffers, the rest straight into out
+ * @return 0 on success; <0 on error
+ */
+static int filev6_read_run(const struct unix_filesystem *u, int first_sect,
+			   int32_t count, int32_t skip, int32_t want, uint8_t *out)
+{
+	uint8_t head[SECTOR_SIZE];
+	uint8_t tail[SECTOR_SIZE];
+	struct iovec iov[3];
+	int iovcnt = 0;
+
+	if (skip > 0) {
+		iov[iovcnt].iov_base = head;
+		iov[iovcnt++].iov_len = (size_t)skip;
+	}
+	iov[iovcnt].iov_base = out;
+	iov[iovcnt++].iov_len = (size_t)want;
+	int32_t rest = count * SECTOR_SIZE - skip - want;
+	if (rest > 0) {
+		iov[iovcnt].iov_base = tail;
+		iov[iovcnt++].iov_len = (size_t)rest;
+	}
+
+	// unallocated sectors (holes) read as zeros
+	if (first_sect == 0) {
+		memset(out, 0, (size_t)want);
+		return 0;
+	}
+	return sector_readv(u, (uint32_t)first_sect, iov, iovcnt);
+}
+
+
+int filev6_read(struct filev6 *fv6, void *buf, int len)
+{
+	// Test for NULL pointer
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(buf);
+	M_REQUIRE_NON_NULL(fv6->u);
+	if (len < 0) {
+		return ERR_BAD_PARAMETER;
+	}
+
+	// never read past the end of file
+	int32_t size = inode_getsize(&(fv6->i_node));
+	if (fv6->offset >= size || len == 0) {
+		return 0;
+	}
+	if (len > size - fv6->offset) {
+		len = size - fv6->offset;
+	}
+
+	uint8_t *out = buf;
+	int32_t done = 0;
+	int32_t first = fv6->offset / SECTOR_SIZE;
+	int32_t last = (fv6->offset + len - 1) / SECTOR_SIZE;
+
+	// one vectored read per extent
+	struct inode_extent_iter iter;
+	struct inode_extent extent;
+	int error = inode_extents_begin(fv6->u, &(fv6->i_node), &(fv6->map),
+					first, last - first + 1, &iter);
+	while (!error && (error = inode_extent_next(&iter, &extent)) == 1) {
+		int32_t skip = (fv6->offset + done) % SECTOR_SIZE;
+		int32_t want = extent.length * SECTOR_SIZE - skip;
+		if (want > len - done) {
+			want = len - done;
+		}
+
+		error = filev6_read_run(fv6->u, (int)extent.physical, extent.length,
+					skip, want, out + done);
+		if (error) {
+			debug_print("[--] filev6_read error sector_readv", NULL);
+			return error;
+		}
+		done += want;
+	}
+	if (error < 0) {
+		debug_print("[--] filev6_read error searching offset", NULL);
+		return error;
+	}
+
+	int32_t start = fv6->offset;
+	fv6->offset += done;
+	filev6_readahead(fv6, start, fv6->offset);
+	return done;
+}
+
+
 int filev6_lseek(struct filev6 *fv6, int32_t offset)
 {
 	M_REQUIRE_NON_NULL(fv6);
@@ -102,14 +291,582 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6)
 
 	//update filev6
 	fv6->i_node = inode;
+	fv6->map.slot = INODE_MAP_EMPTY;
+	filev6_ra_reset(fv6);
 
 	return 0;
 }
 
 
 
+/**
+ * @brief a run of blocks allocated by a writer
+ */
+struct filev6_run {
+	uint16_t first;
+	uint16_t count;
+};
+
+
+/**
+ * @brief state of an append to a file
+ */
+struct filev6_writer {
+	struct unix_filesystem *u;
+	struct filev6 *fv6;
+	int large;              // the file uses indirect blocks
+	int map_dirty;          // fv6->map holds addresses not written yet
+	uint64_t hint;          // where the next block should go
+	struct filev6_run *runs;        // blocks allocated so far, freed on failure
+	size_t nruns;
+	size_t max_runs;        // room in runs
+};
+
+
+/**
+ * @brief finish a write: on failure, give the blocks it allocated back to
+ *        the bitmap and go back to the inode as it is on disk
+ */
+static void filev6_writer_end(struct filev6_writer *w, int error)
+{
+	if (error < 0) {
+		for (size_t k = 0; k < w->nruns; ++k) {
+			bm_clear_range(w->u->fbm, w->runs[k].first, w->runs[k].count);
+		}
+		w->fv6->map.slot = INODE_MAP_EMPTY;
+		(void)inode_read(w->u, w->fv6->i_number, &(w->fv6->i_node));
+	}
+	free(w->runs);
+	w->runs = NULL;
+	w->nruns = 0;
+	w->max_runs = 0;
+}
+
+
+/**
+ * @brief allocate a run of at most n data blocks near the hint, trying
+ *        shorter runs when n free blocks are not found together
+ * @param got the number of blocks allocated (OUT)
+ * @return the first block of the run; <0 on error
+ */
+static int filev6_alloc_run(struct filev6_writer *w, int32_t n, int32_t *got)
+{
+	int error = mountv6_modify(w->u);
+	if (error) {
+		return error;
+	}
+	while (n > 0) {
+		int first = bm_alloc_run(w->u->fbm, (uint64_t)n, w->hint, w->u->alloc_policy);
+		if (first >= 0 && w->nruns == w->max_runs) {
+			size_t max_runs = w->max_runs ? 2 * w->max_runs : 8;
+			struct filev6_run *runs = realloc(w->runs, max_runs * sizeof(struct filev6_run));
+			if (runs == NULL) {
+				bm_clear_range(w->u->fbm, (uint64_t)first, (uint64_t)n);
+				return ERR_NOMEM;
+			}
+			w->runs = runs;
+			w->max_runs = max_runs;
+		}
+		if (first >= 0) {
+			w->runs[w->nruns].first = (uint16_t)first;
+			w->runs[w->nruns++].count = (uint16_t)n;
+			*got = n;
+			w->hint = (uint64_t)first + (uint64_t)n;
+			return first;
+		}
+		n /= 2;
+	}
+	return ERR_BITMAP_FULL;
+}
+
+
+/**
+ * @brief write the indirect block held by the map window if it changed
+ */
+static int filev6_flush_map(struct filev6_writer *w)
+{
+	struct filev6 *fv6 = w->fv6;
+	if (!w->map_dirty) {
+		return 0;
+	}
+	int error = sector_write(w->u, fv6->i_node.i_addr[fv6->map.slot], fv6->map.addr);
+	if (!error) {
+		w->map_dirty = 0;
+	}
+	return error;
+}
+
+
+/**
+ * @brief load in the map window the indirect block of a slot, allocating
+ *        it if the file does not have it yet
+ */
+static int filev6_load_map(struct filev6_writer *w, int slot)
+{
+	struct filev6 *fv6 = w->fv6;
+	if (fv6->map.slot == slot) {
+		return 0;
+	}
+	int error = filev6_flush_map(w);
+	if (error) {
+		return error;
+	}
+
+	fv6->map.slot = INODE_MAP_EMPTY;
+	if (fv6->i_node.i_addr[slot] == 0) {
+		int32_t got = 0;
+		int block = filev6_alloc_run(w, 1, &got);
+		if (block < 0) {
+			return block;
+		}
+		fv6->i_node.i_addr[slot] = (uint16_t)block;
+		memset(fv6->map.addr, 0, sizeof(fv6->map.addr));
+		w->map_dirty = 1;
+	} else {
+		error = sector_read(w->u, fv6->i_node.i_addr[slot], fv6->map.addr);
+		if (error) {
+			return error;
+		}
+	}
+	fv6->map.slot = slot;
+	return 0;
+}
+
+
+/**
+ * @brief record the disk block of a sector of the file
+ */
+static int filev6_set_sector(struct filev6_writer *w, int32_t file_sect, uint16_t block)
+{
+	struct filev6 *fv6 = w->fv6;
+	if (!w->large) {
+		fv6->i_node.i_addr[file_sect] = block;
+		return 0;
+	}
+	int error = filev6_load_map(w, file_sect / ADDRESSES_PER_SECTOR);
+	if (error) {
+		return error;
+	}
+	fv6->map.addr[file_sect % ADDRESSES_PER_SECTOR] = block;
+	w->map_dirty = 1;
+	return 0;
+}
+
+
+/**
+ * @brief move the direct addresses of a small file into a first indirect
+ *        block, as it is about to reach 8 sectors
+ */
+static int filev6_make_large(struct filev6_writer *w)
+{
+	struct filev6 *fv6 = w->fv6;
+	uint16_t direct[ADDR_SMALL_LENGTH];
+	memcpy(direct, fv6->i_node.i_addr, sizeof(direct));
+
+	int32_t got = 0;
+	int block = filev6_alloc_run(w, 1, &got);
+	if (block < 0) {
+		return block;
+	}
+	memset(fv6->i_node.i_addr, 0, sizeof(fv6->i_node.i_addr));
+	fv6->i_node.i_addr[0] = (uint16_t)block;
+	memset(fv6->map.addr, 0, sizeof(fv6->map.addr));
+	memcpy(fv6->map.addr, direct, sizeof(direct));
+	fv6->map.slot = 0;
+	w->map_dirty = 1;
+	w->large = 1;
+	return 0;
+}
+
+
 int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, void *buf, int len)
 {
-	printf("filev6_writebytes not implemented\n");
-	return ERR_IO;
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(buf);
+	if (len < 0) {
+		return ERR_BAD_PARAMETER;
+	}
+	if (u->map != NULL) {
+		return ERR_READ_ONLY;
+	}
+
+	int32_t size = inode_getsize(&(fv6->i_node));
+	if (len == 0) {
+		return 0;
+	}
+	if (len > EXTRA_LARGE_FILE - size) {
+		return ERR_FILE_TOO_LARGE;
+	}
+	int32_t new_size = size + len;
+
+	struct filev6_writer w = { u, fv6, size >= 8 * SECTOR_SIZE, 0, 0, NULL, 0, 0 };
+	const uint8_t *data = buf;
+	int32_t file_sect = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int error = 0;
+
+	// complete the last sector of the file: the only read-modify-write
+	if (size % SECTOR_SIZE != 0) {
+		uint16_t block = 0;
+		error = inode_map_range(u, &(fv6->i_node), &(fv6->map), file_sect - 1, 1, &block);
+		if (error) {
+			return error;
+		}
+		uint8_t sector[SECTOR_SIZE];
+		if (block == 0) {
+			// a hole: it gets a block of its own, zeroed as the hole reads
+			int32_t got = 0;
+			int fresh = filev6_alloc_run(&w, 1, &got);
+			error = (fresh < 0) ? fresh : filev6_set_sector(&w, file_sect - 1, (uint16_t)fresh);
+			block = (fresh < 0) ? 0 : (uint16_t)fresh;
+			memset(sector, 0, sizeof(sector));
+		} else {
+			error = sector_read(u, block, sector);
+		}
+		int32_t head = SECTOR_SIZE - size % SECTOR_SIZE;
+		if (head > len) {
+			head = len;
+		}
+		memcpy(sector + size % SECTOR_SIZE, data, (size_t)head);
+		if (!error) {
+			error = sector_write(u, block, sector);
+		}
+		if (error) {
+			filev6_writer_end(&w, error);
+			return error;
+		}
+		data += head;
+		w.hint = (uint64_t)block + 1;
+	} else if (file_sect > 0) {
+		uint16_t block = 0;
+		if (!inode_map_range(u, &(fv6->i_node), &(fv6->map), file_sect - 1, 1, &block)) {
+			w.hint = (uint64_t)block + 1;
+		}
+	}
+
+	// from 8 sectors on, the addresses go to indirect blocks
+	int32_t remaining = len - (int32_t)(data - (const uint8_t *)buf);
+	if (!w.large && new_size >= 8 * SECTOR_SIZE) {
+		error = filev6_make_large(&w);
+	}
+
+	// the rest goes to new blocks, in runs as long as possible, written
+	// with one call each and without reading anything
+	while (remaining > 0 && !error) {
+		int32_t got = 0;
+		int first = filev6_alloc_run(&w, (remaining + SECTOR_SIZE - 1) / SECTOR_SIZE, &got);
+		if (first < 0) {
+			error = first;
+			break;
+		}
+		for (int32_t k = 0; k < got && !error; ++k) {
+			error = filev6_set_sector(&w, file_sect + k, (uint16_t)(first + k));
+		}
+
+		// whole sectors from buf, the last partial one padded with zeros
+		uint8_t tail[SECTOR_SIZE];
+		struct iovec iov[2];
+		int iovcnt = 0;
+		int32_t bytes = got * SECTOR_SIZE;
+		if (bytes > remaining) {
+			bytes = remaining;
+		}
+		int32_t whole = bytes - bytes % SECTOR_SIZE;
+		if (whole > 0) {
+			iov[iovcnt].iov_base = (void *)(uintptr_t)data;
+			iov[iovcnt++].iov_len = (size_t)whole;
+		}
+		if (bytes > whole) {
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, data + whole, (size_t)(bytes - whole));
+			iov[iovcnt].iov_base = tail;
+			iov[iovcnt++].iov_len = SECTOR_SIZE;
+		}
+		if (!error) {
+			error = sector_writev(u, (uint32_t)first, iov, iovcnt);
+		}
+
+		data += bytes;
+		remaining -= bytes;
+		file_sect += got;
+	}
+
+	if (!error) {
+		error = filev6_flush_map(&w);
+	}
+
+	// the new size and addresses make the data visible
+	if (!error) {
+		error = inode_setsize(&(fv6->i_node), new_size);
+	}
+	if (!error) {
+		error = inode_write(u, fv6->i_number, &(fv6->i_node));
+	}
+	filev6_writer_end(&w, error);
+	return error;
+}
+
+
+/**
+ * @brief give a disk block to every hole among the given sectors of the
+ *        file, so that they can be written in place; the new blocks are
+ *        zeroed, as the holes read
+ */
+static int filev6_fill_holes(struct filev6_writer *w, int32_t first, int32_t count)
+{
+	struct filev6 *fv6 = w->fv6;
+	static const uint8_t zeros[SECTOR_SIZE];
+	for (int32_t s = first; s < first + count; ++s) {
+		// the map window must hold what is on disk before it moves
+		uint16_t block = 0;
+		int error = filev6_flush_map(w);
+		if (!error) {
+			error = inode_map_range(w->u, &(fv6->i_node), &(fv6->map), s, 1, &block);
+		}
+		if (!error && block == 0) {
+			int32_t got = 0;
+			int fresh = filev6_alloc_run(w, 1, &got);
+			error = (fresh < 0) ? fresh : sector_write(w->u, (uint32_t)fresh, zeros);
+			if (!error) {
+				error = filev6_set_sector(w, s, (uint16_t)fresh);
+			}
+		}
+		if (error) {
+			return error;
+		}
+	}
+	return filev6_flush_map(w);
+}
+
+
+/**
+ * @brief overwrite part of one run of physically contiguous sectors with a
+ *        single vectored write: the sectors written partly are read first
+ * @param first_sect the first sector of the run, which holds byte skip
+ * @param skip the offset of the first byte to write, in the first sector
+ * @param want the number of bytes to write
+ * @param in the bytes to write
+ * @return 0 on success; <0 on error
+ */
+static int filev6_write_run(struct unix_filesystem *u, uint32_t first_sect,
+			    int32_t skip, int32_t want, const uint8_t *in)
+{
+	uint8_t head[SECTOR_SIZE];
+	uint8_t tail[SECTOR_SIZE];
+	struct iovec iov[3];
+	int iovcnt = 0;
+	uint32_t sect = first_sect;
+
+	// a first sector not written from its start or not to its end
+	if (skip > 0 || want < SECTOR_SIZE) {
+		int32_t n = SECTOR_SIZE - skip;
+		if (n > want) {
+			n = want;
+		}
+		int error = sector_read(u, sect++, head);
+		if (error) {
+			return error;
+		}
+		memcpy(head + skip, in, (size_t)n);
+		iov[iovcnt].iov_base = head;
+		iov[iovcnt++].iov_len = SECTOR_SIZE;
+		in += n;
+		want -= n;
+	}
+
+	// whole sectors straight from the caller, then a last partial one
+	int32_t whole = want - want % SECTOR_SIZE;
+	if (whole > 0) {
+		iov[iovcnt].iov_base = (void *)(uintptr_t)in;
+		iov[iovcnt++].iov_len = (size_t)whole;
+		sect += (uint32_t)(whole / SECTOR_SIZE);
+	}
+	if (want > whole) {
+		int error = sector_read(u, sect, tail);
+		if (error) {
+			return error;
+		}
+		memcpy(tail, in + whole, (size_t)(want - whole));
+		iov[iovcnt].iov_base = tail;
+		iov[iovcnt++].iov_len = SECTOR_SIZE;
+	}
+	return sector_writev(u, first_sect, iov, iovcnt);
+}
+
+
+int filev6_write(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	M_REQUIRE_NON_NULL(buf);
+	if (len < 0) {
+		return ERR_BAD_PARAMETER;
+	}
+	if (u->map != NULL) {
+		return ERR_READ_ONLY;
+	}
+
+	int32_t size = inode_getsize(&(fv6->i_node));
+	if (len > EXTRA_LARGE_FILE - fv6->offset) {
+		return ERR_FILE_TOO_LARGE;
+	}
+	int32_t over = size - fv6->offset;
+	if (over > len) {
+		over = len;
+	}
+
+	// the bytes inside the file are written in place, one run per extent
+	const uint8_t *data = buf;
+	if (over > 0) {
+		int32_t first = fv6->offset / SECTOR_SIZE;
+		int32_t count = (fv6->offset + over - 1) / SECTOR_SIZE - first + 1;
+		struct filev6_writer w = { u, fv6, size >= 8 * SECTOR_SIZE, 0, 0, NULL, 0, 0 };
+		int error = filev6_fill_holes(&w, first, count);
+
+		struct inode_extent_iter iter;
+		struct inode_extent extent;
+		int32_t done = 0;
+		if (!error) {
+			error = inode_extents_begin(u, &(fv6->i_node), &(fv6->map), first, count, &iter);
+		}
+		while (!error && (error = inode_extent_next(&iter, &extent)) == 1) {
+			int32_t skip = (fv6->offset + done) % SECTOR_SIZE;
+			int32_t want = extent.length * SECTOR_SIZE - skip;
+			if (want > over - done) {
+				want = over - done;
+			}
+			error = filev6_write_run(u, extent.physical, skip, want, data + done);
+			done += want;
+		}
+
+		// the blocks given to holes are in i_addr or indirect blocks
+		if (!error && w.nruns > 0) {
+			error = inode_write(u, fv6->i_number, &(fv6->i_node));
+		}
+		filev6_writer_end(&w, error);
+		if (error) {
+			return error;
+		}
+	}
+
+	// the rest is appended
+	if (len > over) {
+		int error = filev6_writebytes(u, fv6, (void *)(uintptr_t)(data + over), len - over);
+		if (error) {
+			return error;
+		}
+	}
+	fv6->offset += len;
+	return len;
+}
+
+
+int filev6_truncate(struct unix_filesystem *u, struct filev6 *fv6, int32_t new_size)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(fv6);
+	if (new_size < 0) {
+		return ERR_BAD_PARAMETER;
+	}
+	if (new_size > EXTRA_LARGE_FILE) {
+		return ERR_FILE_TOO_LARGE;
+	}
+	if (u->map != NULL) {
+		return ERR_READ_ONLY;
+	}
+
+	// a longer file gets zeros, written like any append
+	int32_t size = inode_getsize(&(fv6->i_node));
+	static uint8_t zeros[8 * SECTOR_SIZE];
+	while (size < new_size) {
+		int32_t n = new_size - size;
+		if (n > (int32_t)sizeof(zeros)) {
+			n = (int32_t)sizeof(zeros);
+		}
+		int error = filev6_writebytes(u, fv6, zeros, n);
+		if (error) {
+			return error;
+		}
+		size += n;
+	}
+	if (size == new_size) {
+		return 0;
+	}
+
+	// a shorter one: note the blocks to free before changing the inode
+	int32_t keep = (new_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int32_t had = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int large = size >= 8 * SECTOR_SIZE;
+	int stays_large = new_size >= 8 * SECTOR_SIZE;
+	int32_t slots = large ? (had + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR : 0;
+	int32_t kept_slots = stays_large ? (keep + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR : 0;
+	uint16_t *freed = calloc((size_t)(had - keep + slots) + 1, sizeof(uint16_t));
+	if (freed == NULL) {
+		return ERR_NOMEM;
+	}
+	size_t nfreed = 0;
+
+	struct inode_extent_iter iter;
+	struct inode_extent extent;
+	int error = inode_extents_begin(u, &(fv6->i_node), &(fv6->map), keep, had - keep, &iter);
+	while (!error && (error = inode_extent_next(&iter, &extent)) == 1) {
+		for (int32_t k = 0; extent.physical != 0 && k < extent.length; ++k) {
+			freed[nfreed++] = (uint16_t)(extent.physical + (uint32_t)k);
+		}
+		error = 0;
+	}
+	for (int32_t slot = kept_slots; error >= 0 && slot < slots; ++slot) {
+		if (fv6->i_node.i_addr[slot] != 0) {
+			freed[nfreed++] = fv6->i_node.i_addr[slot];
+		}
+	}
+
+	// the addresses left: direct ones, or indirect blocks cut after keep
+	uint16_t direct[ADDR_SMALL_LENGTH];
+	memset(direct, 0, sizeof(direct));
+	if (error >= 0 && large && !stays_large && keep > 0) {
+		error = inode_map_range(u, &(fv6->i_node), &(fv6->map), 0, keep, direct);
+	} else if (error >= 0 && !large) {
+		memcpy(direct, fv6->i_node.i_addr, (size_t)keep * sizeof(uint16_t));
+	}
+	if (error >= 0 && stays_large && keep % ADDRESSES_PER_SECTOR != 0) {
+		uint16_t block = 0;
+		error = inode_map_range(u, &(fv6->i_node), &(fv6->map), keep - 1, 1, &block);
+		if (!error) {
+			memset(&fv6->map.addr[keep % ADDRESSES_PER_SECTOR], 0,
+			       (size_t)(ADDRESSES_PER_SECTOR - keep % ADDRESSES_PER_SECTOR) * sizeof(uint16_t));
+			error = sector_write(u, fv6->i_node.i_addr[kept_slots - 1], fv6->map.addr);
+		}
+	}
+	if (error < 0) {
+		free(freed);
+		fv6->map.slot = INODE_MAP_EMPTY;
+		return error;
+	}
+
+	if (stays_large) {
+		memset(&fv6->i_node.i_addr[kept_slots], 0,
+		       (size_t)(ADDR_SMALL_LENGTH - kept_slots) * sizeof(uint16_t));
+	} else {
+		memcpy(fv6->i_node.i_addr, direct, sizeof(direct));
+	}
+	fv6->map.slot = INODE_MAP_EMPTY;
+	filev6_ra_reset(fv6);
+	if (fv6->offset > new_size) {
+		fv6->offset = new_size;
+	}
+	error = inode_setsize(&(fv6->i_node), new_size);
+	if (!error) {
+		error = inode_write(u, fv6->i_number, &(fv6->i_node));
+	}
+
+	// the blocks go back to the bitmap once nothing points to them
+	for (size_t k = 0; !error && k < nfreed; ++k) {
+		bm_clear(u->fbm, freed[k]);
+	}
+	free(freed);
+	return error;
 }
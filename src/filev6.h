@@ -10,16 +10,28 @@
 
 #include "unixv6fs.h"
 #include "mount.h"
+#include "inode.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief readahead state of an open file
+ */
+struct filev6_readahead {
+    int32_t expected;                    // offset a sequential read would start at
+    int32_t window;                      // sectors read ahead, 0 when the access is not sequential
+    int32_t ahead;                       // first sector of the file not read ahead yet
+};
+
 struct filev6 {
     const struct unix_filesystem *u;     // the filesystem
     uint16_t i_number;                   // the inode number (on disk)
     struct inode i_node;                 // the content of the inode
     int32_t offset;                      // the current cursor within the file (in bytes)
+    struct inode_map map;                // last indirect block used, see inode_map_range()
+    struct filev6_readahead ra;          // sequential access detection
 };
 
 /**
@@ -47,6 +59,26 @@ int filev6_lseek(struct filev6 *fv6, int32_t offset);
  */
 int filev6_readblock(struct filev6 *fv6, void *buf);
 
+/**
+ * @brief read up to len bytes from the file at the current cursor, with one
+ *        vectored disk read per run of physically contiguous sectors
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to len bytes of available memory (OUT)
+ * @param len the number of bytes wanted; need not be a multiple of SECTOR_SIZE
+ * @return >=0: the number of bytes read (0 at end of file); <0 error
+ */
+int filev6_read(struct filev6 *fv6, void *buf, int len);
+
+/**
+ * @brief same as filev6_readblock, but without copying the data when the
+ *        disk is memory-mapped: *block then points into the mapping
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to SECTOR_SIZE bytes of available memory, used when the disk is not mapped (OUT)
+ * @param block set to the data read: either buf or a read-only pointer into the mapping (OUT)
+ * @return >0: the number of bytes of the file read; 0: end of file; <0 error
+ */
+int filev6_mapblock(struct filev6 *fv6, void *buf, const void **block);
+
 /**
  * @brief create a new filev6
  * @param u the filesystem (IN)
@@ -57,15 +89,39 @@ int filev6_readblock(struct filev6 *fv6, void *buf);
 int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6);
 
 /**
- * @brief write the len bytes of the given buffer on disk to the given filev6
+ * @brief write the len bytes of the given buffer on disk at the end of the
+ *        given filev6; new blocks are allocated in contiguous runs and the
+ *        file switches to indirect blocks when it reaches 8 sectors
  * @param u the filesystem (IN)
- * @param fv6 the filev6 (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated)
  * @param buf the data we want to write (IN)
  * @param len the length of the bytes we want to write
  * @return 0 on success; <0 on errror
  */
 int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, void *buf, int len);
 
+/**
+ * @brief write len bytes at the current cursor, in place over the content
+ *        of the file (holes get blocks) and appended past its end
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; offset will be changed, its inode updated)
+ * @param buf the data we want to write (IN)
+ * @param len the number of bytes; need not be a multiple of SECTOR_SIZE
+ * @return >=0: the number of bytes written (len); <0 on error
+ */
+int filev6_write(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len);
+
+/**
+ * @brief change the size of a file: a longer file is padded with zeros, a
+ *        shorter one gives its blocks past the new end back to the bitmap
+ *        (a large file becoming small goes back to direct addresses)
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN-OUT; its inode is updated, offset clamped)
+ * @param new_size the new size in bytes
+ * @return 0 on success; <0 on error
+ */
+int filev6_truncate(struct unix_filesystem *u, struct filev6 *fv6, int32_t new_size);
+
 
 #ifdef __cplusplus
 }
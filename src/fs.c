@@ -16,7 +16,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include "mount.h"
 #include "direntv6.h"
 #include "error.h"
@@ -24,6 +26,68 @@
 
 struct unix_filesystem fs = {0};
 
+/* kernel caches, overridden by -o attr_timeout=T,entry_timeout=T,negative_timeout=T:
+ * the kernel sees every change made through the mount, so the entries and
+ * attributes it keeps stay valid long */
+#define FS_DEFAULT_TIMEOUTS "-oattr_timeout=60,entry_timeout=60,negative_timeout=60"
+
+/**
+ * @brief options of the daemon itself, the others go to libfuse
+ */
+struct fs_config {
+	int kernel_cache;	// let the kernel keep the pages of a file not changed since it read them
+};
+
+static struct fs_config config = { 1 };
+
+static const struct fuse_opt fs_opts[] = {
+	{ "kernel_cache", offsetof(struct fs_config, kernel_cache), 1 },
+	{ "no_kernel_cache", offsetof(struct fs_config, kernel_cache), 0 },
+	FUSE_OPT_END
+};
+
+/**
+ * @brief version of an inode, telling whether the kernel may keep the pages
+ *        it cached of it when the file is opened again
+ */
+struct fs_version {
+	uint32_t changed;	// bumped by every change the daemon makes to the inode
+	uint32_t cached;	// value of changed at the last open
+};
+
+static struct fs_version *versions = NULL;	// one per inode, NULL disables kernel_cache
+static size_t nversions = 0;
+static pthread_mutex_t versions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief note that the daemon changed an inode, whose pages cached by the
+ *        kernel (if any) must not outlive the next open
+ */
+static void version_bump(uint16_t inr)
+{
+	pthread_mutex_lock(&versions_lock);
+	if (inr < nversions) {
+		++versions[inr].changed;
+	}
+	pthread_mutex_unlock(&versions_lock);
+}
+
+/**
+ * @brief tell whether the kernel may keep the pages of a file being opened
+ * @return 1 if the inode did not change since the previous open; 0 otherwise
+ */
+static int version_open(uint16_t inr)
+{
+	pthread_mutex_lock(&versions_lock);
+	int keep = 0;
+	if (config.kernel_cache && inr < nversions) {
+		keep = (versions[inr].cached == versions[inr].changed);
+		versions[inr].cached = versions[inr].changed;
+	}
+	pthread_mutex_unlock(&versions_lock);
+	return keep;
+}
+
 int is_mounted(struct unix_filesystem* u)
 {
         if (u->f == NULL) {
@@ -91,6 +155,399 @@ static int arg_parse(void *data, const char *filename, int key, struct fuse_args
 }
 
 
+/**
+ * @brief       fill the attributes of a file from its inode
+ * @param i     the inode
+ * @param inr   its number
+ * @param stbuf the attributes (OUT)
+ */
+static void fill_stat(const struct inode *i, uint16_t inr, struct stat *stbuf)
+{
+	memset(stbuf, 0, sizeof(struct stat));
+	stbuf->st_ino = inr;
+	stbuf->st_mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+	if ((i->i_mode & IFMT) == IFDIR) {
+		stbuf->st_mode |= S_IFDIR;
+	} else {
+		stbuf->st_mode |= S_IFREG;
+	}
+	stbuf->st_nlink = i->i_nlink;
+	stbuf->st_uid = i->i_uid;
+	stbuf->st_gid = i->i_gid;
+	stbuf->st_size = inode_getsize(i);
+}
+
+/**
+ * @brief translate an error of the filesystem into the negated errno the
+ *        kernel expects, e.g. ENOENT for a missing entry
+ * @param error an error code, or a result >= 0 left as is
+ * @return -errno if error < 0; error otherwise
+ */
+static int fs_errno(int error)
+{
+	switch (error) {
+	case ERR_NOMEM:
+		return -ENOMEM;
+	case ERR_INODE_OUTOF_RANGE:
+	case ERR_UNALLOCATED_INODE:
+		return -ENOENT;
+	case ERR_FILENAME_TOO_LONG:
+		return -ENAMETOOLONG;
+	case ERR_INVALID_DIRECTORY_INODE:
+		return -ENOTDIR;
+	case ERR_FILENAME_ALREADY_EXISTS:
+		return -EEXIST;
+	case ERR_BITMAP_FULL:
+	case ERR_NOT_ENOUGH_BLOCS:
+		return -ENOSPC;
+	case ERR_FILE_TOO_LARGE:
+		return -EFBIG;
+	case ERR_OFFSET_OUT_OF_RANGE:
+	case ERR_BAD_PARAMETER:
+		return -EINVAL;
+	case ERR_READ_ONLY:
+		return -EROFS;
+	case ERR_DIRECTORY_NOT_EMPTY:
+		return -ENOTEMPTY;
+	case ERR_IS_A_DIRECTORY:
+		return -EISDIR;
+	default:
+		return error < 0 ? -EIO : error;
+	}
+}
+
+#define FS_WRITEBACK_SIZE (64 * 1024) /* bytes of writes buffered per open inode */
+
+/**
+ * @brief an inode open through one or more handles
+ *
+ * Consecutive writes, through any of its handles, are gathered in wbuf and
+ * reach the disk at once: when a write does not follow them, on flush
+ * (close), fsync and release, and before a read, a getattr or a truncate
+ * of the inode, so that nothing sees the file without them.
+ *
+ * Once fs_read_buf() replied with ranges of the disk image, the data
+ * blocks the inode gives up are kept in fbm until its last handle is
+ * released: see hold_begin().
+ */
+struct fs_file {
+	uint16_t inr;
+	size_t refs;		// handles and operations using it (files_lock)
+	struct fs_file *next;	// list of the open inodes (files_lock)
+	int unlinked;		// the inode was freed, it is out of the list (fs.lock)
+	pthread_mutex_t lock;	// the pending writes, taken before fs.lock
+	char *wbuf;		// pending writes, FS_WRITEBACK_SIZE bytes once allocated
+	off_t woff;		// offset of wbuf in the file
+	size_t wlen;		// number of pending bytes
+	int error;		// of a write-back, not reported yet by flush or fsync
+	int pinned;		// read_buf replies may read its blocks (files_lock)
+	struct fs_run *held;	// blocks freed since, still set in fbm (fs.lock)
+	size_t nheld;
+};
+
+/**
+ * @brief run of data blocks
+ */
+struct fs_run {
+	uint32_t first;
+	uint32_t count;
+};
+
+static struct fs_file *files = NULL;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief find an open inode and take a reference on it
+ * @param inr the inode
+ * @param create 1 to open it if it is not open yet
+ * @return the open inode; NULL if it is not open (or out of memory)
+ */
+static struct fs_file *file_get(uint16_t inr, int create)
+{
+	pthread_mutex_lock(&files_lock);
+	struct fs_file *file = files;
+	while (file != NULL && file->inr != inr) {
+		file = file->next;
+	}
+	if (file == NULL && create) {
+		file = calloc(1, sizeof(struct fs_file));
+		if (file != NULL) {
+			file->inr = inr;
+			pthread_mutex_init(&(file->lock), NULL);
+			file->next = files;
+			files = file;
+		}
+	}
+	if (file != NULL) {
+		++file->refs;
+	}
+	pthread_mutex_unlock(&files_lock);
+	return file;
+}
+
+/**
+ * @brief take an open inode out of the list (files_lock held)
+ */
+static void file_unlist(struct fs_file *file)
+{
+	struct fs_file **link = &files;
+	while (*link != NULL && *link != file) {
+		link = &((*link)->next);
+	}
+	if (*link != NULL) {
+		*link = file->next;
+	}
+}
+
+/**
+ * @brief drop a reference taken by file_get()
+ * @return 1 if it was the last one, the open inode being out of the list
+ */
+static int file_unref(struct fs_file *file)
+{
+	pthread_mutex_lock(&files_lock);
+	int last = (--file->refs == 0);
+	if (last && !file->unlinked) {
+		file_unlist(file);
+	}
+	pthread_mutex_unlock(&files_lock);
+	return last;
+}
+
+/**
+ * @brief free an open inode, whose pending writes must have been flushed,
+ *        giving back the blocks it held (fs.lock held for writing if any)
+ */
+static void file_free(struct fs_file *file)
+{
+	for (size_t k = 0; k < file->nheld; ++k) {
+		bm_clear_range(fs.fbm, file->held[k].first, file->held[k].count);
+	}
+	pthread_mutex_destroy(&(file->lock));
+	free(file->held);
+	free(file->wbuf);
+	free(file);
+}
+
+/**
+ * @brief release a reference taken by file_get(); the last one frees the
+ *        open inode
+ */
+static void file_put(struct fs_file *file)
+{
+	if (!file_unref(file)) {
+		return;
+	}
+	// no reply can read the held blocks any more: its handles are released
+	if (file->nheld > 0) {
+		pthread_rwlock_wrlock(&fs.lock);
+		file_free(file);
+		pthread_rwlock_unlock(&fs.lock);
+	} else {
+		file_free(file);
+	}
+}
+
+/**
+ * @brief data blocks an operation is about to free, see hold_begin()
+ */
+struct fs_hold {
+	struct fs_file *file;	// NULL if nothing is to be held
+	struct fs_run *runs;
+	size_t nruns;
+};
+
+/**
+ * @brief before an operation frees the data blocks of an inode from a
+ *        sector on, list them if read_buf replies may still read them
+ *        (fs.lock held for writing)
+ *
+ * libfuse reads the ranges given by fs_read_buf() after the locks are
+ * released; were their blocks given to another file in between, the reply
+ * would carry its data. hold_end() therefore sets those blocks again in
+ * fbm, until the last handle of the inode, thus the last reply, is gone.
+ * @return 0 on success; <0 on error
+ */
+static int hold_begin(struct fs_hold *hold, uint16_t inr, int32_t from)
+{
+	memset(hold, 0, sizeof(*hold));
+	hold->file = file_get(inr, 0);
+	if (hold->file == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&files_lock);
+	int pinned = hold->file->pinned;
+	pthread_mutex_unlock(&files_lock);
+
+	struct inode i;
+	int error = pinned ? inode_read(&fs, inr, &i) : 0;
+	int32_t sectors = 0;
+	if (pinned && !error) {
+		int32_t size = inode_getsize(&i);
+		sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	}
+
+	struct inode_extent_iter iter;
+	struct inode_extent extent;
+	if (from < sectors) {
+		error = inode_extents_begin(&fs, &i, NULL, from, sectors - from, &iter);
+	}
+	while (!error && from < sectors && (error = inode_extent_next(&iter, &extent)) == 1) {
+		error = 0;
+		if (extent.physical == 0) {
+			continue;
+		}
+		struct fs_run *runs = realloc(hold->runs, (hold->nruns + 1) * sizeof(struct fs_run));
+		if (runs == NULL) {
+			error = ERR_NOMEM;
+		} else {
+			hold->runs = runs;
+			hold->runs[hold->nruns].first = extent.physical;
+			hold->runs[hold->nruns].count = (uint32_t)extent.length;
+			++hold->nruns;
+		}
+	}
+	if (error < 0 || hold->nruns == 0) {
+		free(hold->runs);
+		if (file_unref(hold->file)) {
+			file_free(hold->file);	// its last handle was released meanwhile
+		}
+		memset(hold, 0, sizeof(*hold));
+	}
+	return error < 0 ? error : 0;
+}
+
+/**
+ * @brief after the operation, set again in fbm the listed blocks it freed
+ *        and keep them with the open inode (fs.lock held for writing)
+ */
+static void hold_end(struct fs_hold *hold)
+{
+	struct fs_file *file = hold->file;
+	if (file == NULL) {
+		return;
+	}
+	for (size_t k = 0; k < hold->nruns; ++k) {
+		for (uint32_t x = hold->runs[k].first; x < hold->runs[k].first + hold->runs[k].count; ++x) {
+			if (bm_get(fs.fbm, x) != 0) {
+				continue;	// still used: not freed
+			}
+			bm_set(fs.fbm, x);
+			if (file->nheld > 0 && file->held[file->nheld - 1].first
+			    + file->held[file->nheld - 1].count == x) {
+				++file->held[file->nheld - 1].count;
+				continue;
+			}
+			struct fs_run *held = realloc(file->held, (file->nheld + 1) * sizeof(struct fs_run));
+			if (held == NULL) {
+				continue;	// lost until fsck, rather than exposed
+			}
+			file->held = held;
+			file->held[file->nheld].first = x;
+			file->held[file->nheld].count = 1;
+			++file->nheld;
+		}
+	}
+	free(hold->runs);
+	if (file_unref(file)) {
+		file_free(file);
+	}
+}
+
+/**
+ * @brief note that an inode was freed: its pending writes go nowhere, and
+ *        file_get() does not find it if the number is reused (fs.lock held
+ *        for writing)
+ */
+static void file_unlinked(uint16_t inr)
+{
+	pthread_mutex_lock(&files_lock);
+	struct fs_file *file = files;
+	while (file != NULL && file->inr != inr) {
+		file = file->next;
+	}
+	if (file != NULL) {
+		file->unlinked = 1;
+		file_unlist(file);
+	}
+	pthread_mutex_unlock(&files_lock);
+}
+
+/**
+ * @brief write bytes at any offset of an open inode, the gap past its end
+ *        reading as zeros (file lock and fs.lock held for writing)
+ * @return 0 on success; <0 on error
+ */
+static int file_write(struct fs_file *file, const char *buf, size_t size, off_t offset)
+{
+	if (offset < 0 || size > EXTRA_LARGE_FILE || offset > (off_t)(EXTRA_LARGE_FILE - size)) {
+		return ERR_FILE_TOO_LARGE;
+	}
+	// the data of a freed inode goes nowhere
+	if (file->unlinked) {
+		return 0;
+	}
+
+	struct filev6 fv6;
+	int error = filev6_open(&fs, file->inr, &fv6);
+	if (!error && offset > inode_getsize(&(fv6.i_node))) {
+		error = filev6_truncate(&fs, &fv6, (int32_t)offset);
+	}
+	if (!error) {
+		error = filev6_lseek(&fv6, (int32_t)offset);
+	}
+	if (!error) {
+		error = filev6_write(&fs, &fv6, buf, (int)size);
+	}
+	// even a failed write may leave the kernel with pages the disk does not have
+	version_bump(file->inr);
+	return error < 0 ? error : 0;
+}
+
+/**
+ * @brief write the pending bytes of an open inode (its lock held); they
+ *        are dropped even if the write fails, the error being kept until
+ *        the next flush or fsync reports it
+ * @return 1 if bytes were written; 0 otherwise
+ */
+static int file_flush(struct fs_file *file)
+{
+	if (file->wlen == 0) {
+		return 0;
+	}
+	pthread_rwlock_wrlock(&fs.lock);
+	int error = file_write(file, file->wbuf, file->wlen, file->woff);
+	pthread_rwlock_unlock(&fs.lock);
+	file->wlen = 0;
+	if (error) {
+		file->error = error;
+	}
+	return 1;
+}
+
+/**
+ * @brief take the lock of an open inode to write its pending bytes
+ * @return 1 if bytes were written; 0 otherwise
+ */
+static int file_writeback(struct fs_file *file)
+{
+	pthread_mutex_lock(&(file->lock));
+	int flushed = file_flush(file);
+	pthread_mutex_unlock(&(file->lock));
+	return flushed;
+}
+
+/**
+ * @brief report the error of a write-back once
+ * @return 0 or the error kept by file_flush() (file lock held)
+ */
+static int file_take_error(struct fs_file *file)
+{
+	int error = file->error;
+	file->error = 0;
+	return error;
+}
+
 static int fs_getattr(const char *path, struct stat *stbuf)
 {
 	int res = 0;
@@ -99,23 +556,26 @@ static int fs_getattr(const char *path, struct stat *stbuf)
         struct inode i;
 	debug_print("get arguments path %s\n", path);
 
+	pthread_rwlock_rdlock(&fs.lock);
         res = fill_inode(path, &i, &inr);
+	pthread_rwlock_unlock(&fs.lock);
+
+	// the size must count the writes acknowledged but still pending
+	struct fs_file *file = res ? NULL : file_get(inr, 0);
+	if (file != NULL) {
+		if (file_writeback(file)) {
+			pthread_rwlock_rdlock(&fs.lock);
+			res = fill_inode(path, &i, &inr);
+			pthread_rwlock_unlock(&fs.lock);
+		}
+		file_put(file);
+	}
         if(res) {
 		debug_print("[--] get arguments %s\n", path);
-                return res;
+                return fs_errno(res);
         }
 
-	memset(stbuf, 0, sizeof(struct stat));
-	stbuf->st_mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-	if ((i.i_mode & IFMT) == IFDIR) {
-		stbuf->st_mode |= S_IFDIR;
-	} else {
-		stbuf->st_mode |= S_IFREG;
-	}
-	stbuf->st_nlink = i.i_nlink;
-	stbuf->st_uid = i.i_uid;
-	stbuf->st_gid = i.i_gid;
-	stbuf->st_size = i.i_size1;
+	fill_stat(&i, inr, stbuf);
 	inode_print(&i);
 	debug_print("[OK] get arguments %s\n", path);
 	return res;
@@ -134,117 +594,528 @@ static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	(void) fi;
 	uint16_t inr;
 	struct inode i;
-	struct directory_reader d;
-	char name[DIRENT_MAXLEN + 1];
+	struct direntv6_list list;
 
 	// read the inode number given the path
+	pthread_rwlock_rdlock(&fs.lock);
 	res = fill_inode(path, &i, &inr);//Correcteur : dirlookup was enough
 	if (res) {
+		pthread_rwlock_unlock(&fs.lock);
 		debug_print("[--] readdir fill_inode %s\n", path);
-		return  res;
+		return fs_errno(res);
 	}
 
-	// Open the directory to read it
-	res = direntv6_opendir(&fs, inr, &d);
+	// Read the whole directory at once, with the inodes of its entries
+	res = direntv6_readdir_plus(&fs, inr, &list);
+	pthread_rwlock_unlock(&fs.lock);
 	if (res) {
-		debug_print("[--] readdir opendir %s\n", path);
-		return res;
+		debug_print("[--] readdir readdir_plus %s\n", path);
+		return fs_errno(res);
 	}
 
-	filler(buf, ".", NULL, 0);
+	struct stat st;
+	fill_stat(&i, inr, &st);
+	filler(buf, ".", &st, 0);
 	filler(buf, "..", NULL, 0);
 
-        // list all file in the folder
-        do {
-		res = direntv6_readdir(&d, name, &inr);
-		if (res == 1) {
-			name[DIRENT_MAXLEN] = '\0';
-			filler(buf, name, NULL, 0);//correcteur : check return value
-		} else if (res == 0) {
-			return 0;
-		} else if (res == ERR_UNALLOCATED_INODE) {
-			return 0;
+	// list all file in the folder, until the buffer of the kernel is full
+	for (size_t k = 0; k < list.count; ++k) {
+		const struct inode *child = &list.inodes[k];
+		if (child->i_mode & IALLOC) {
+			fill_stat(child, list.entries[k].inr, &st);
 		}
-
-	} while (res == 1);
+		if (filler(buf, list.entries[k].name,
+			   (child->i_mode & IALLOC) ? &st : NULL, 0)) {
+			break;
+		}
+	}
+	direntv6_list_free(&list);
 	debug_print("[OK] readdir %s\n", path);
-        return res;
+	return 0;
+}
+
+/**
+ * @brief state of an open file, kept in fi->fh from open to release
+ */
+struct fs_handle {
+	pthread_mutex_t lock;	// the kernel may send concurrent reads on a handle
+	struct filev6 fv6;	// inode, indirect block window and readahead state
+	struct fs_file *file;	// the open inode, shared with its other handles
+};
+
+static struct fs_handle *get_handle(const struct fuse_file_info *fi)
+{
+	return (struct fs_handle *)(uintptr_t)fi->fh;
+}
+
+/**
+ * @brief open a file for the handle of fi (fs.lock held)
+ * @return 0 on success; <0 on error
+ */
+static int open_handle(uint16_t inr, struct fuse_file_info *fi)
+{
+	struct fs_handle *handle = calloc(1, sizeof(struct fs_handle));
+	if (handle == NULL) {
+		return ERR_NOMEM;
+	}
+	int error = filev6_open(&fs, inr, &(handle->fv6));
+	if (!error) {
+		handle->file = file_get(inr, 1);
+		error = (handle->file == NULL) ? ERR_NOMEM : 0;
+	}
+	if (error) {
+		free(handle);
+		return error;
+	}
+	pthread_mutex_init(&(handle->lock), NULL);
+	fi->fh = (uint64_t)(uintptr_t)handle;
+	return 0;
+}
+
+/**
+ * @brief reload the inode of an open file, changed through another handle
+ *        or path (handle lock and fs.lock held)
+ * @return 0 on success; <0 on error
+ */
+static int handle_refresh(struct fs_handle *handle)
+{
+	struct inode i;
+	int error = inode_read(&fs, handle->fv6.i_number, &i);
+	if (error) {
+		return error;
+	}
+	if (memcmp(&i, &(handle->fv6.i_node), sizeof(i)) != 0) {
+		handle->fv6.i_node = i;
+		handle->fv6.map.slot = INODE_MAP_EMPTY;
+	}
+	return 0;
 }
 
 static int fs_open(const char *path, struct fuse_file_info *fi)
 {
+	M_REQUIRE_NON_NULL(path);
+	M_REQUIRE_NON_NULL(fi);
+
+	// resolve the path once for all the reads of this open file
+	uint16_t inr;
+	struct inode i;
+	pthread_rwlock_rdlock(&fs.lock);
+	int error = fill_inode(path, &i, &inr);
+	if (!error) {
+		error = open_handle(inr, fi);
+	}
+	pthread_rwlock_unlock(&fs.lock);
+	if (error) {
+		return fs_errno(error);
+	}
+	fi->keep_cache = version_open(inr) ? 1 : 0;
+
+	debug_print("[OK] open %s: #%" PRIu16 "\n", path, inr);
+	return 0;
+}
+
+static int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	M_REQUIRE_NON_NULL(path);
+	M_REQUIRE_NON_NULL(fi);
+	(void) mode; // fill_stat gives every file the same permissions
+
+	pthread_rwlock_wrlock(&fs.lock);
+	int inr = direntv6_create(&fs, path, 0);
+	int error = (inr < 0) ? inr : open_handle((uint16_t)inr, fi);
+	pthread_rwlock_unlock(&fs.lock);
+	if (error) {
+		return fs_errno(error);
+	}
+	version_bump((uint16_t)inr);
+	fi->keep_cache = version_open((uint16_t)inr) ? 1 : 0;
+
+	debug_print("[OK] create %s: #%d\n", path, inr);
 	return 0;
 }
 
+static int fs_write(const char *path, const char *buf, size_t size, off_t offset,
+		    struct fuse_file_info *fi)
+{
+	M_REQUIRE_NON_NULL(path);
+	M_REQUIRE_NON_NULL(buf);
+	M_REQUIRE_NON_NULL(fi);
+
+	struct fs_handle *handle = get_handle(fi);
+	if (handle == NULL) {
+		return fs_errno(ERR_BAD_PARAMETER);
+	}
+
+	struct fs_file *file = handle->file;
+	pthread_mutex_lock(&(file->lock));
+
+	// the pending bytes go first unless this write extends them
+	if (file->wlen > 0 && (offset != file->woff + (off_t)file->wlen
+			       || file->wlen + size > FS_WRITEBACK_SIZE)) {
+		(void)file_flush(file);
+	}
+	int error = file_take_error(file);
+
+	if (!error && size >= FS_WRITEBACK_SIZE) {
+		// nothing to gain from buffering that much
+		pthread_rwlock_wrlock(&fs.lock);
+		error = file_write(file, buf, size, offset);
+		pthread_rwlock_unlock(&fs.lock);
+	} else if (!error) {
+		if (file->wbuf == NULL) {
+			file->wbuf = malloc(FS_WRITEBACK_SIZE);
+			error = (file->wbuf == NULL) ? ERR_NOMEM : 0;
+		}
+		if (!error) {
+			if (file->wlen == 0) {
+				file->woff = offset;
+			}
+			memcpy(file->wbuf + file->wlen, buf, size);
+			file->wlen += size;
+		}
+	}
 
+	pthread_mutex_unlock(&(file->lock));
+	return error ? fs_errno(error) : (int)size;
+}
+
+static int fs_flush(const char *path, struct fuse_file_info *fi)
+{
+	(void) path;
+	M_REQUIRE_NON_NULL(fi);
+
+	struct fs_handle *handle = get_handle(fi);
+	if (handle == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&(handle->file->lock));
+	(void)file_flush(handle->file);
+	int error = file_take_error(handle->file);
+	pthread_mutex_unlock(&(handle->file->lock));
+	return fs_errno(error);
+}
+
+static int fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void) path;
+	(void) datasync;
+	M_REQUIRE_NON_NULL(fi);
+
+	// the pending bytes of the handle, then everything the caches hold
+	int error = fs_flush(path, fi);
+	if (error) {
+		return error;
+	}
+	pthread_rwlock_wrlock(&fs.lock);
+	error = mountv6_sync(&fs);
+	pthread_rwlock_unlock(&fs.lock);
+	return fs_errno(error);
+}
+
+/**
+ * @brief change the size of a file once the pending writes of the inode
+ *        are on disk, and before any other write reaches it
+ * @param path the name the inode must still have, NULL for an open file
+ * @param inr the inode
+ * @param file the inode open, NULL if it is not
+ * @return 0 on success; 1 if path names another inode by now; <0 on error
+ */
+static int truncate_file(const char *path, uint16_t inr, struct fs_file *file, off_t size)
+{
+	if (file != NULL) {
+		pthread_mutex_lock(&(file->lock));
+		(void)file_flush(file);
+	}
+
+	uint16_t now = inr;
+	struct inode i;
+	struct filev6 fv6;
+	pthread_rwlock_wrlock(&fs.lock);
+	int error = (path != NULL) ? fill_inode(path, &i, &now) : 0;
+	if (!error && now != inr) {
+		error = 1;
+	}
+	if (!error && file != NULL && file->unlinked) {
+		error = ERR_UNALLOCATED_INODE;
+	}
+	if (!error) {
+		error = filev6_open(&fs, inr, &fv6);
+	}
+	if (!error && (fv6.i_node.i_mode & IFMT) == IFDIR) {
+		error = ERR_IS_A_DIRECTORY;
+	}
+	struct fs_hold hold = {0};
+	if (!error) {
+		error = hold_begin(&hold, inr, (int32_t)((size + SECTOR_SIZE - 1) / SECTOR_SIZE));
+	}
+	if (!error) {
+		error = filev6_truncate(&fs, &fv6, (int32_t)size);
+		version_bump(inr);
+		hold_end(&hold);
+	}
+	pthread_rwlock_unlock(&fs.lock);
+
+	if (file != NULL) {
+		pthread_mutex_unlock(&(file->lock));
+	}
+	return error;
+}
+
+static int fs_truncate(const char *path, off_t size)
+{
+	M_REQUIRE_NON_NULL(path);
+	if (size < 0 || size > EXTRA_LARGE_FILE) {
+		return fs_errno(size < 0 ? ERR_BAD_PARAMETER : ERR_FILE_TOO_LARGE);
+	}
+
+	// the pending writes of the inode, if open, must be flushed first:
+	// its lock goes before fs.lock, the path is resolved again under both
+	int error = 1;
+	while (error == 1) {
+		uint16_t inr;
+		struct inode i;
+		pthread_rwlock_rdlock(&fs.lock);
+		error = fill_inode(path, &i, &inr);
+		pthread_rwlock_unlock(&fs.lock);
+		if (!error) {
+			struct fs_file *file = file_get(inr, 0);
+			error = truncate_file(path, inr, file, size);
+			if (file != NULL) {
+				file_put(file);
+			}
+		}
+	}
+	return fs_errno(error);
+}
+
+static int fs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	(void) path;
+	M_REQUIRE_NON_NULL(fi);
+	if (size < 0 || size > EXTRA_LARGE_FILE) {
+		return fs_errno(size < 0 ? ERR_BAD_PARAMETER : ERR_FILE_TOO_LARGE);
+	}
+
+	struct fs_handle *handle = get_handle(fi);
+	if (handle == NULL) {
+		return fs_errno(ERR_BAD_PARAMETER);
+	}
+	return fs_errno(truncate_file(NULL, handle->file->inr, handle->file, size));
+}
+
+static int fs_mkdir(const char *path, mode_t mode)
+{
+	M_REQUIRE_NON_NULL(path);
+	(void) mode;
+
+	pthread_rwlock_wrlock(&fs.lock);
+	int inr = direntv6_create(&fs, path, IFDIR);
+	pthread_rwlock_unlock(&fs.lock);
+	return inr < 0 ? fs_errno(inr) : 0;
+}
+
+static int fs_unlink(const char *path)
+{
+	M_REQUIRE_NON_NULL(path);
+
+	pthread_rwlock_wrlock(&fs.lock);
+	int inr = direntv6_dirlookup(&fs, ROOT_INUMBER, path);
+	struct fs_hold hold = {0};
+	int error = (inr > 0) ? hold_begin(&hold, (uint16_t)inr, 0) : 0;
+	if (!error) {
+		error = direntv6_unlink(&fs, path);
+		hold_end(&hold);
+	}
+	if (!error) {
+		file_unlinked((uint16_t)inr);
+	}
+	pthread_rwlock_unlock(&fs.lock);
+	return fs_errno(error);
+}
+
+static int fs_rmdir(const char *path)
+{
+	M_REQUIRE_NON_NULL(path);
+
+	pthread_rwlock_wrlock(&fs.lock);
+	int error = direntv6_rmdir(&fs, path);
+	pthread_rwlock_unlock(&fs.lock);
+	return fs_errno(error);
+}
+
+static int fs_rename(const char *from, const char *to)
+{
+	M_REQUIRE_NON_NULL(from);
+	M_REQUIRE_NON_NULL(to);
+
+	pthread_rwlock_wrlock(&fs.lock);
+	int inr = direntv6_dirlookup(&fs, ROOT_INUMBER, from);
+	int victim = direntv6_dirlookup(&fs, ROOT_INUMBER, to);
+	struct fs_hold hold = {0};
+	int error = (victim > 0 && victim != inr) ? hold_begin(&hold, (uint16_t)victim, 0) : 0;
+	if (!error) {
+		error = direntv6_rename(&fs, from, to);
+		hold_end(&hold);
+	}
+	if (!error && victim > 0 && victim != inr) {
+		// the inode the target named is freed
+		file_unlinked((uint16_t)victim);
+	}
+	pthread_rwlock_unlock(&fs.lock);
+	return fs_errno(error);
+}
+
+static int fs_release(const char *path, struct fuse_file_info *fi)
+{
+	(void) path;
+	M_REQUIRE_NON_NULL(fi);
+
+	// the kernel ignores what release returns, flush reported it already
+	struct fs_handle *handle = get_handle(fi);
+	if (handle != NULL) {
+		(void)file_writeback(handle->file);
+		file_put(handle->file);
+		pthread_mutex_destroy(&(handle->lock));
+		free(handle);
+	}
+	fi->fh = 0;
+	return 0;
+}
 
 
 static int fs_read(const char *path, char *buf, size_t size, off_t offset,
 		   struct fuse_file_info *fi)
 {
-	(void) fi;
 	M_REQUIRE_NON_NULL(path);
 	M_REQUIRE_NON_NULL(buf);
         M_REQUIRE_NON_NULL(fi);
 
-	// The number of sectors that can be read
-	size_t to_read_sector = size / SECTOR_SIZE;
+	struct fs_handle *handle = get_handle(fi);
+	if (handle == NULL) {
+		return fs_errno(ERR_BAD_PARAMETER);
+	}
 
-	if (is_mounted(&fs)) {
-		struct inode i;
-		uint16_t inr;
+	// the cursor and readahead state of the handle are shared
+	pthread_mutex_lock(&(handle->lock));
+	(void)file_writeback(handle->file);
+	pthread_rwlock_rdlock(&fs.lock);
+	int res = handle->file->unlinked ? 0 : handle_refresh(handle);
 
-		memset(buf, '\0', size * sizeof(char));
+	// Adjust the offset of fv6, nothing to read past the end of file
+	if (!res && !handle->file->unlinked && filev6_lseek(&(handle->fv6), (int32_t)offset) == 0) {
+		// Read the data straight into buf, until its size or end of file
+		res = filev6_read(&(handle->fv6), buf, (int)size);
+	}
 
-		// Get the inr of inode
-		int error = fill_inode(path, &i, &inr);//correcteur : dirlookup was enough
-		if (error) {
-			return error;
-		}
+	pthread_rwlock_unlock(&fs.lock);
+	pthread_mutex_unlock(&(handle->lock));
+	return fs_errno(res);
+}
+
+/**
+ * @brief reply to a read with ranges of the disk image rather than with
+ *        data, so that the kernel splices them to the reader: one range
+ *        per extent of the file, holes as zeroed memory. libfuse reads the
+ *        ranges after the locks are released: the inode is then pinned,
+ *        and the blocks a truncate, unlink or rename frees stay allocated
+ *        until its last handle is released (see hold_begin()). A write in
+ *        between may still make the reply newer than the read. The stdio
+ *        backend, which has no usable descriptor, reads into memory.
+ */
+static int fs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+		       off_t offset, struct fuse_file_info *fi)
+{
+	M_REQUIRE_NON_NULL(path);
+	M_REQUIRE_NON_NULL(bufp);
+	M_REQUIRE_NON_NULL(fi);
+
+	struct fs_handle *handle = get_handle(fi);
+	if (handle == NULL) {
+		return fs_errno(ERR_BAD_PARAMETER);
+	}
+	struct filev6 *fv6 = &(handle->fv6);
 
-		struct filev6 fv6;
-		memset(&fv6, 255, sizeof(struct filev6));
+	pthread_mutex_lock(&(handle->lock));
+	(void)file_writeback(handle->file);
+	pthread_rwlock_rdlock(&fs.lock);
+	int error = handle->file->unlinked ? 0 : handle_refresh(handle);
 
-		// Open the filev6
-		error = filev6_open(&fs, inr, &fv6);
-		if (error) {
-			return error;
+	// never past the end of file, nothing left of a freed inode
+	int32_t file_size = handle->file->unlinked ? 0 : inode_getsize(&(fv6->i_node));
+	int32_t len = 0;
+	if (offset >= 0 && offset < file_size) {
+		len = (size > (size_t)(file_size - offset)) ? file_size - (int32_t)offset : (int32_t)size;
+	}
+	int32_t first = (int32_t)offset / SECTOR_SIZE;
+	int32_t count = len > 0 ? ((int32_t)offset + len - 1) / SECTOR_SIZE - first + 1 : 0;
+
+	// at most one buffer per sector
+	struct fuse_bufvec *bufv = NULL;
+	if (!error) {
+		bufv = calloc(1, sizeof(struct fuse_bufvec)
+			      + (size_t)(count > 1 ? count - 1 : 0) * sizeof(struct fuse_buf));
+		error = (bufv == NULL) ? ERR_NOMEM : 0;
+	}
+
+	if (!error && len > 0 && fs.io_mode == SECTOR_IO_STDIO) {
+		bufv->count = 1;
+		bufv->buf[0].mem = malloc((size_t)len);
+		error = (bufv->buf[0].mem == NULL) ? ERR_NOMEM : filev6_lseek(fv6, (int32_t)offset);
+		if (!error) {
+			int read = filev6_read(fv6, bufv->buf[0].mem, len);
+			error = (read < 0) ? read : 0;
+			bufv->buf[0].size = (read < 0) ? 0 : (size_t)read;
 		}
+	} else if (!error && len > 0) {
+		// the disk must hold what the buffer cache has not written back yet
+		error = sector_flush(&fs);
 
-		// Adjust the offset of fv6
-		error = filev6_lseek(&fv6, (int32_t)offset);
-                if (error) {
-			return 0;
-			return error;
+		struct inode_extent_iter iter;
+		struct inode_extent extent;
+		int32_t done = 0;
+		if (!error) {
+			error = inode_extents_begin(&fs, &(fv6->i_node), &(fv6->map), first, count, &iter);
 		}
+		while (!error && (error = inode_extent_next(&iter, &extent)) == 1) {
+			int32_t skip = ((int32_t)offset + done) % SECTOR_SIZE;
+			int32_t want = extent.length * SECTOR_SIZE - skip;
+			if (want > len - done) {
+				want = len - done;
+			}
 
-		size_t j = 0;
-		int return_code;
-		char data[SECTOR_SIZE+1];
-		// Read the data until buf size or end of file
-		do {
-			memset(data, '\0', (SECTOR_SIZE+1) * sizeof(char));
-			return_code = filev6_readblock(&fv6, data);//orrecteur : coherent with your readblock but please refactor
-			if (return_code == SECTOR_SIZE) {
-				memcpy(&buf[j * SECTOR_SIZE], data, strlen(data)+1);
-				++j;
+			struct fuse_buf *buf = &(bufv->buf[bufv->count++]);
+			buf->size = (size_t)want;
+			error = 0;
+			if (extent.physical == 0) {
+				// unallocated sectors (holes) read as zeros
+				buf->mem = calloc(1, (size_t)want);
+				error = (buf->mem == NULL) ? ERR_NOMEM : 0;
+			} else {
+				buf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY;
+				buf->fd = fs.fd;
+				buf->pos = (off_t)extent.physical * SECTOR_SIZE + skip;
 			}
+			done += want;
 		}
-		while(j < to_read_sector && return_code == SECTOR_SIZE);
-
+		// before fs.lock is released, for no block to be freed unheld
+		pthread_mutex_lock(&files_lock);
+		handle->file->pinned = 1;
+		pthread_mutex_unlock(&files_lock);
+	}
 
+	pthread_rwlock_unlock(&fs.lock);
+	pthread_mutex_unlock(&(handle->lock));
 
-		// End of file
-		if (return_code == 0) {
-			return (int)(j * SECTOR_SIZE);
-		} else if (return_code == SECTOR_SIZE) {
-			return (int)(j * SECTOR_SIZE);
-		} else {
-			return  return_code;
+	if (error < 0) {
+		// libfuse frees what it gets the same way
+		for (size_t k = 0; bufv != NULL && k < bufv->count; ++k) {
+			free(bufv->buf[k].mem);
 		}
+		free(bufv);
+		return fs_errno(error);
 	}
-
-	return (int)size;
+	*bufp = bufv;
+	return 0;
 }
 
 static struct fuse_operations available_ops = {
@@ -252,15 +1123,42 @@ static struct fuse_operations available_ops = {
 	.readdir	= fs_readdir,
 	.open		= fs_open,
 	.read		= fs_read,
+	.read_buf	= fs_read_buf,
+	.release	= fs_release,
+	.create		= fs_create,
+	.write		= fs_write,
+	.flush		= fs_flush,
+	.fsync		= fs_fsync,
+	.truncate	= fs_truncate,
+	.ftruncate	= fs_ftruncate,
+	.mkdir		= fs_mkdir,
+	.unlink		= fs_unlink,
+	.rmdir		= fs_rmdir,
+	.rename		= fs_rename,
 };
 
 int main(int argc, char *argv[])
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-	int ret = fuse_opt_parse(&args, NULL, NULL, arg_parse);
+	int ret = fuse_opt_parse(&args, &config, fs_opts, arg_parse);
+	if (ret == 0) {
+		// the defaults go before the options given, for them to take over
+		ret = fuse_opt_insert_arg(&args, 1, FS_DEFAULT_TIMEOUTS);
+	}
+	if (ret == 0 && fs.f != NULL) {
+		// without versions, files are read again at each open
+		nversions = (size_t)fs.s.s_isize * INODES_PER_SECTOR;
+		versions = calloc(nversions, sizeof(struct fs_version));
+		if (versions == NULL) {
+			nversions = 0;
+		}
+	}
 	if (ret == 0) {
+		// multithreaded unless -s is given: every operation locks fs.lock
 		ret = fuse_main(args.argc, args.argv, &available_ops, NULL);
 		(void)umountv6(&fs);
 	}
+	free(versions);
+	fuse_opt_free_args(&args);
 	return ret;
 }
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "icache.h"
+
+
+/**
+ * @brief bucket of the hash table holding the given inode
+ */
+static struct icache_entry **icache_bucket(struct icache *cache, uint16_t inr)
+{
+	return &cache->buckets[inr & (cache->nbuckets - 1)];
+}
+
+
+/**
+ * @brief find the entry holding the given inode
+ * @return the entry or NULL if the inode is not cached
+ */
+static struct icache_entry *icache_find(struct icache *cache, uint16_t inr)
+{
+	struct icache_entry *entry = *icache_bucket(cache, inr);
+	while (entry != NULL && entry->inr != inr) {
+		entry = entry->hnext;
+	}
+	return entry;
+}
+
+
+static void lru_unlink(struct icache *cache, struct icache_entry *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->mru = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->lru = entry->prev;
+	}
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+
+static void lru_push_front(struct icache *cache, struct icache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->mru;
+	if (cache->mru) {
+		cache->mru->prev = entry;
+	} else {
+		cache->lru = entry;
+	}
+	cache->mru = entry;
+}
+
+
+static void lru_push_back(struct icache *cache, struct icache_entry *entry)
+{
+	entry->next = NULL;
+	entry->prev = cache->lru;
+	if (cache->lru) {
+		cache->lru->next = entry;
+	} else {
+		cache->mru = entry;
+	}
+	cache->lru = entry;
+}
+
+
+/**
+ * @brief remove an entry from the hash table and mark it reusable
+ */
+static void icache_unhash(struct icache *cache, struct icache_entry *entry)
+{
+	struct icache_entry **link = icache_bucket(cache, entry->inr);
+	while (*link != entry) {
+		link = &(*link)->hnext;
+	}
+	*link = entry->hnext;
+	entry->hnext = NULL;
+	entry->valid = 0;
+}
+
+
+struct icache *icache_alloc(size_t capacity)
+{
+	// test argument
+	if (capacity == 0) {
+		return NULL;
+	}
+
+	struct icache *cache = calloc(1, sizeof(struct icache)
+				      + (capacity - 1) * sizeof(struct icache_entry));
+	if (!cache) {
+		return NULL;
+	}
+
+	// twice as many buckets as entries, rounded to a power of 2
+	size_t nbuckets = 1;
+	while (nbuckets < 2 * capacity) {
+		nbuckets <<= 1;
+	}
+	cache->buckets = calloc(nbuckets, sizeof(struct icache_entry *));
+	if (!cache->buckets) {
+		free(cache);
+		return NULL;
+	}
+	cache->capacity = capacity;
+	cache->nbuckets = nbuckets;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	// all entries start free, in the LRU list
+	for (size_t i = 0; i < capacity; ++i) {
+		lru_push_back(cache, &cache->entries[i]);
+	}
+
+	return cache;
+}
+
+
+void icache_free(struct icache *cache)
+{
+	if (!cache) {
+		return;
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->buckets);
+	free(cache);
+}
+
+
+int icache_lookup(struct icache *cache, uint16_t inr, struct inode *inode)
+{
+	pthread_mutex_lock(&cache->lock);
+	struct icache_entry *entry = icache_find(cache, inr);
+	if (entry == NULL) {
+		++cache->stats.misses;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	// move to the front of the LRU list
+	lru_unlink(cache, entry);
+	lru_push_front(cache, entry);
+
+	*inode = entry->inode;
+	++cache->stats.hits;
+	pthread_mutex_unlock(&cache->lock);
+	return 1;
+}
+
+
+struct icache_entry *icache_insert(struct icache *cache, uint16_t inr,
+				   const struct inode *inode)
+{
+	pthread_mutex_lock(&cache->lock);
+	struct icache_entry *entry = icache_find(cache, inr);
+	if (entry == NULL) {
+		// recycle the least recently used buffer that can be
+		entry = cache->lru;
+		while (entry != NULL && entry->valid && (entry->refcount || entry->dirty)) {
+			entry = entry->prev;
+		}
+		if (entry == NULL) {
+			pthread_mutex_unlock(&cache->lock);
+			return NULL;
+		}
+		if (entry->valid) {
+			icache_unhash(cache, entry);
+			++cache->stats.evictions;
+		}
+		entry->inr = inr;
+		entry->valid = 1;
+		entry->dirty = 0;
+		struct icache_entry **bucket = icache_bucket(cache, inr);
+		entry->hnext = *bucket;
+		*bucket = entry;
+	}
+
+	lru_unlink(cache, entry);
+	lru_push_front(cache, entry);
+	entry->inode = *inode;
+	++entry->refcount;
+	pthread_mutex_unlock(&cache->lock);
+	return entry;
+}
+
+
+void icache_put(struct icache *cache, struct icache_entry *entry)
+{
+	if (entry == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&cache->lock);
+	if (entry->refcount > 0) {
+		--entry->refcount;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void icache_mark_dirty(struct icache *cache, struct icache_entry *entry)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (!entry->dirty) {
+		entry->dirty = 1;
+		++cache->ndirty;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+void icache_mark_clean(struct icache *cache, struct icache_entry *entry)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (entry->dirty) {
+		entry->dirty = 0;
+		--cache->ndirty;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+static int entry_inr_cmp(const void *a, const void *b)
+{
+	const struct icache_entry *x = *(const struct icache_entry * const *)a;
+	const struct icache_entry *y = *(const struct icache_entry * const *)b;
+	return (x->inr > y->inr) - (x->inr < y->inr);
+}
+
+
+size_t icache_ndirty(struct icache *cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	size_t ndirty = cache->ndirty;
+	pthread_mutex_unlock(&cache->lock);
+	return ndirty;
+}
+
+
+size_t icache_dirty(struct icache *cache, struct icache_entry **out, size_t max)
+{
+	size_t count = 0;
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = 0; i < cache->capacity && count < max; ++i) {
+		if (cache->entries[i].valid && cache->entries[i].dirty) {
+			out[count++] = &cache->entries[i];
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	qsort(out, count, sizeof(*out), entry_inr_cmp);
+	return count;
+}
+
+
+void icache_print_stats(const struct icache *cache)
+{
+	if (!cache) {
+		printf("inode cache disabled\n");
+		return;
+	}
+
+	printf("**********INODE CACHE START**********\n");
+	printf("capacity\t: %zu inodes\n", cache->capacity);
+	printf("hits\t\t: %" PRIu64 "\n", cache->stats.hits);
+	printf("misses\t\t: %" PRIu64 "\n", cache->stats.misses);
+	printf("evictions\t: %" PRIu64 "\n", cache->stats.evictions);
+	printf("writebacks\t: %" PRIu64 "\n", cache->stats.writebacks);
+	printf("**********INODE CACHE END************\n");
+}
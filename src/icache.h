@@ -0,0 +1,136 @@
+#pragma once
+
+/**
+ * @file icache.h
+ * @brief in-core cache of decoded inodes, sitting under inode_read/inode_write
+ *
+ * Fixed number of entries, indexed by a hash table on the inode number and
+ * recycled in least-recently-used order. Entries are pinned while their
+ * reference count is not zero, and modified ones stay dirty until written
+ * back (see inode_flush()), so they are never recycled before. Every
+ * function takes the lock of the cache, so that threads may share it; the
+ * content of an entry is only modified under the write lock of the
+ * filesystem.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "unixv6fs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ICACHE_DEFAULT_SIZE 256 /* inodes, i.e. 16 sectors of the table */
+
+struct icache_stats {
+	uint64_t hits;          /* lookups served from memory */
+	uint64_t misses;        /* lookups that had to go to disk */
+	uint64_t evictions;     /* entries recycled to hold another inode */
+	uint64_t writebacks;    /* inode table sectors written back */
+};
+
+struct icache_entry {
+	uint16_t inr;
+	int valid;
+	int dirty;                      /* modified since read from disk */
+	unsigned int refcount;          /* users of the entry, pinned if not 0 */
+	struct inode inode;
+	struct icache_entry *hnext;     /* next entry in the same hash bucket */
+	struct icache_entry *prev;      /* LRU list, towards most recently used */
+	struct icache_entry *next;      /* LRU list, towards least recently used */
+};
+
+struct icache {
+	pthread_mutex_t lock;           /* protects everything below */
+	size_t capacity;                /* number of entries */
+	size_t nbuckets;                /* size of the hash table (power of 2) */
+	size_t ndirty;                  /* number of dirty entries */
+	struct icache_entry **buckets;
+	struct icache_entry *mru;       /* head of the LRU list */
+	struct icache_entry *lru;       /* tail of the LRU list */
+	struct icache_stats stats;
+	struct icache_entry entries[1];
+};
+
+/**
+ * @brief allocate a new inode cache
+ * @param capacity the number of inodes it can hold (>0)
+ * @return a pointer to the newly created cache or NULL on failure
+ */
+struct icache *icache_alloc(size_t capacity);
+
+/**
+ * @brief release an inode cache; dirty entries are lost
+ * @param cache the cache to free (may be NULL)
+ */
+void icache_free(struct icache *cache);
+
+/**
+ * @brief copy a cached inode, if present
+ * @param cache the cache
+ * @param inr the inode number
+ * @param inode the content of the inode (OUT)
+ * @return 1 on hit; 0 on miss
+ */
+int icache_lookup(struct icache *cache, uint16_t inr, struct inode *inode);
+
+/**
+ * @brief cache an inode and take a reference on it, recycling the least
+ *        recently used entry that is neither pinned nor dirty
+ * @param cache the cache
+ * @param inr the inode number
+ * @param inode the content of the inode (IN)
+ * @return the entry, to be released with icache_put(); NULL if every
+ *         entry is pinned or dirty (write some back and retry)
+ */
+struct icache_entry *icache_insert(struct icache *cache, uint16_t inr,
+				   const struct inode *inode);
+
+/**
+ * @brief release a reference taken by icache_insert()
+ * @param cache the cache
+ * @param entry the entry
+ */
+void icache_put(struct icache *cache, struct icache_entry *entry);
+
+/**
+ * @brief flag a cached inode as modified
+ * @param cache the cache
+ * @param entry the entry
+ */
+void icache_mark_dirty(struct icache *cache, struct icache_entry *entry);
+
+/**
+ * @brief flag a cached inode as identical to its copy on disk
+ * @param cache the cache
+ * @param entry the entry
+ */
+void icache_mark_clean(struct icache *cache, struct icache_entry *entry);
+
+/**
+ * @brief count the dirty entries
+ * @param cache the cache
+ * @return the number of dirty entries
+ */
+size_t icache_ndirty(struct icache *cache);
+
+/**
+ * @brief list the dirty entries, sorted by inode number
+ * @param cache the cache
+ * @param out room for max pointers (OUT)
+ * @param max the number of pointers out can hold
+ * @return the number of entries stored in out
+ */
+size_t icache_dirty(struct icache *cache, struct icache_entry **out, size_t max);
+
+/**
+ * @brief print the counters of a cache
+ * @param cache the cache
+ */
+void icache_print_stats(const struct icache *cache);
+
+#ifdef __cplusplus
+}
+#endif
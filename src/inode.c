@@ -1,11 +1,10 @@
 #include <inttypes.h>
 #include <string.h>
+#include <stdlib.h>
 #include "inode.h"
 #include "sector.h"
 #include "error.h"
-
-// Size above which the file is considered an extra large file
-#define EXTRA_LARGE_FILE 7*256*SECTOR_SIZE
+#include "icache.h"
 
 // Helper function used to print one inode
 void inode_print_one(const struct inode *inode, size_t number)
@@ -29,18 +28,39 @@ void inode_print_one(const struct inode *inode, size_t number)
 	}
 }
 
+int inode_setsize(struct inode *inode, int new_size)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(inode);
+	if (new_size < 0 || new_size > 0xFFFFFF) {
+		return ERR_BAD_PARAMETER;
+	}
+
+	// 8 most significant bits in i_size0, 16 least in i_size1
+	inode->i_size0 = (uint8_t)(new_size >> 16);
+	inode->i_size1 = (uint16_t)(new_size & 0xFFFF);
+	return 0;
+}
+
+
 int inode_scan_print(const struct unix_filesystem *u)
 {
 	// test if the pointer are non null
 	M_REQUIRE_NON_NULL(u);
 
 
+	// the table on disk must hold the cached modifications
+	int flushed = inode_flush(u);
+	if (flushed) {
+		return flushed;
+	}
+
 	// create a table containing the sector
 	struct inode sector[INODES_PER_SECTOR];
 
 	for(uint16_t i = 0; i < u->s.s_isize; ++i) {
 		// read the sector, and keep the error if any
-		int error = sector_read(u->f,(uint32_t) u->s.s_inode_start + i, sector);
+		int error = sector_read(u, (uint32_t) u->s.s_inode_start + i, sector);
 		if (error != 0) {
 			return error;
 		}
@@ -95,16 +115,31 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
 		return ERR_INODE_OUTOF_RANGE;
 	}
 
-	// load corresponding sector and check for error
-	int error = sector_read(u->f, u->s.s_inode_start + n_sector, sector);
-	if (error) {
-		return error;
+	// served from the inode cache when possible
+	if (u->icache != NULL) {
+		if (icache_lookup(u->icache, inr, inode)) {
+			return (inode->i_mode & IALLOC) ? 0 : ERR_UNALLOCATED_INODE;
+		}
+	}
+
+	// use the mapped sector directly if any, else load it and check for error
+	const struct inode *table = sector_map(u, u->s.s_inode_start + n_sector);
+	if (table == NULL) {
+		int error = sector_read(u, u->s.s_inode_start + n_sector, sector);
+		if (error) {
+			return error;
+		}
+		table = sector;
+	}
+
+	if (u->icache != NULL) {
+		icache_put(u->icache, icache_insert(u->icache, inr, &table[n_inode]));
 	}
 
 	// check if inode used, otherwise send and error
-	if (sector[n_inode].i_mode & IALLOC) {
+	if (table[n_inode].i_mode & IALLOC) {
 		//debug_print("read_inode\n", NULL);
-			*inode = sector[n_inode];
+			*inode = table[n_inode];
 		return 0;
 	} else {
 		return ERR_UNALLOCATED_INODE;
@@ -112,6 +147,88 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
 }
 
 
+/**
+ * @brief an inode wanted by inode_read_many() and its place in the output
+ */
+struct inode_want {
+	uint16_t inr;
+	size_t index;
+};
+
+
+static int inode_want_cmp(const void *a, const void *b)
+{
+	const struct inode_want *x = a;
+	const struct inode_want *y = b;
+	return (x->inr > y->inr) - (x->inr < y->inr);
+}
+
+
+int inode_read_many(const struct unix_filesystem *u, const uint16_t *inrs,
+		    size_t count, struct inode *inodes, int *errors)
+{
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(inodes);
+	M_REQUIRE_NON_NULL(errors);
+	if (count == 0) {
+		return 0;
+	}
+	M_REQUIRE_NON_NULL(inrs);
+
+	struct inode_want *wants = calloc(count, sizeof(struct inode_want));
+	if (wants == NULL) {
+		return ERR_NOMEM;
+	}
+
+	// the inode cache first, the rest sorted so as to group it by sector
+	size_t missing = 0;
+	for (size_t k = 0; k < count; ++k) {
+		if (inrs[k] / INODES_PER_SECTOR >= u->s.s_isize) {
+			errors[k] = ERR_INODE_OUTOF_RANGE;
+			continue;
+		}
+		if (u->icache != NULL && icache_lookup(u->icache, inrs[k], &inodes[k])) {
+			errors[k] = (inodes[k].i_mode & IALLOC) ? 0 : ERR_UNALLOCATED_INODE;
+			continue;
+		}
+		wants[missing].inr = inrs[k];
+		wants[missing].index = k;
+		++missing;
+	}
+	qsort(wants, missing, sizeof(struct inode_want), inode_want_cmp);
+
+	// each sector of the inode table is read once
+	int error = 0;
+	size_t first = 0;
+	while (first < missing && !error) {
+		uint16_t n_sector = wants[first].inr / INODES_PER_SECTOR;
+		struct inode sector[INODES_PER_SECTOR];
+		const struct inode *table = sector_map(u, u->s.s_inode_start + n_sector);
+		if (table == NULL) {
+			error = sector_read(u, u->s.s_inode_start + n_sector, sector);
+			table = sector;
+		}
+
+		size_t last = first;
+		for (; last < missing && wants[last].inr / INODES_PER_SECTOR == n_sector; ++last) {
+			if (error) {
+				continue;
+			}
+			const struct inode *inode = &table[wants[last].inr % INODES_PER_SECTOR];
+			inodes[wants[last].index] = *inode;
+			errors[wants[last].index] = (inode->i_mode & IALLOC) ? 0 : ERR_UNALLOCATED_INODE;
+			if (u->icache != NULL && (last == first || wants[last].inr != wants[last - 1].inr)) {
+				icache_put(u->icache, icache_insert(u->icache, wants[last].inr, inode));
+			}
+		}
+		first = last;
+	}
+
+	free(wants);
+	return error;
+}
+
+
 
  int inode_findsector(const struct unix_filesystem *u, const struct inode *i,
 	int32_t file_sec_off)
@@ -170,19 +287,170 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
 		uint16_t sector[ADDRESSES_PER_SECTOR];
 
 		// read the sector containing the other sector address
-		int error = sector_read(u->f, (uint32_t)(i->i_addr[addr_sect]),sector);
-		if(error) {
-			debug_print("%d",error);
-			return error;
+		// (or use it in place when the disk is mapped)
+		const uint16_t *addresses = sector_map(u, (uint32_t)(i->i_addr[addr_sect]));
+		if (addresses == NULL) {
+			int error = sector_read(u, (uint32_t)(i->i_addr[addr_sect]),sector);
+			if(error) {
+				debug_print("%d",error);
+				return error;
+			}
+			addresses = sector;
 		}
 		// return the correspond addr stored in the sector of address
 		debug_print("[OK] findsector bigger than 8\n", NULL);
-		return sector[addr_sect_off];
+		return addresses[addr_sect_off];
 	}
 }
 
 
 
+int inode_map_range(const struct unix_filesystem *u, const struct inode *i,
+		    struct inode_map *map, int32_t first, int32_t count, uint16_t *out)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(i);
+	M_REQUIRE_NON_NULL(out);
+	if (first < 0 || count < 0) {
+		return ERR_BAD_PARAMETER;
+	}
+	if ((i->i_mode & IALLOC) == 0) {
+		return ERR_UNALLOCATED_INODE;
+	}
+
+	int32_t inode_size = inode_getsize(i);
+	if (inode_size > EXTRA_LARGE_FILE) {
+		return ERR_FILE_TOO_LARGE;
+	}
+	if (first + count > (inode_size + SECTOR_SIZE - 1) / SECTOR_SIZE) {
+		return ERR_OFFSET_OUT_OF_RANGE;
+	}
+
+	// small file: the addresses are in the inode
+	if (inode_size < (8*SECTOR_SIZE)) {
+		memcpy(out, &i->i_addr[first], (size_t)count * sizeof(uint16_t));
+		return 0;
+	}
+
+	// large file: decode each indirect block once
+	struct inode_map local;
+	if (map == NULL) {
+		local.slot = INODE_MAP_EMPTY;
+		map = &local;
+	}
+	int32_t done = 0;
+	while (done < count) {
+		int slot = (first + done) / ADDRESSES_PER_SECTOR;
+		if (map->slot != slot) {
+			// like inode_findsector, read whatever i_addr[slot] names
+			map->slot = INODE_MAP_EMPTY;
+			int error = sector_read(u, i->i_addr[slot], map->addr);
+			if (error) {
+				return error;
+			}
+			map->slot = slot;
+		}
+
+		int32_t index = (first + done) % ADDRESSES_PER_SECTOR;
+		int32_t n = ADDRESSES_PER_SECTOR - index;
+		if (n > count - done) {
+			n = count - done;
+		}
+		memcpy(out + done, &map->addr[index], (size_t)n * sizeof(uint16_t));
+		done += n;
+	}
+	return 0;
+}
+
+
+int inode_extents_begin(const struct unix_filesystem *u, const struct inode *i,
+			struct inode_map *map, int32_t first, int32_t count,
+			struct inode_extent_iter *iter)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(i);
+	M_REQUIRE_NON_NULL(iter);
+	if (first < 0 || count < 0
+	    || first + count > (inode_getsize(i) + SECTOR_SIZE - 1) / SECTOR_SIZE) {
+		return ERR_OFFSET_OUT_OF_RANGE;
+	}
+
+	iter->u = u;
+	iter->inode = i;
+	iter->map = map;
+	iter->next = first;
+	iter->end = first + count;
+	iter->base = first;
+	iter->mapped = 0;
+	return 0;
+}
+
+
+/**
+ * @brief disk sector of a file sector of the walk, mapping the following
+ *        ones in the same batch when it is not known yet
+ */
+static int extent_sector(struct inode_extent_iter *iter, int32_t file_sect,
+			 uint16_t *sect)
+{
+	if (file_sect < iter->base || file_sect >= iter->base + iter->mapped) {
+		int32_t count = iter->end - file_sect;
+		if (count > ADDRESSES_PER_SECTOR) {
+			count = ADDRESSES_PER_SECTOR;
+		}
+		int error = inode_map_range(iter->u, iter->inode, iter->map,
+					    file_sect, count, iter->sectors);
+		if (error) {
+			iter->mapped = 0;
+			return error;
+		}
+		iter->base = file_sect;
+		iter->mapped = count;
+	}
+	*sect = iter->sectors[file_sect - iter->base];
+	return 0;
+}
+
+
+int inode_extent_next(struct inode_extent_iter *iter, struct inode_extent *extent)
+{
+	// test arguments
+	M_REQUIRE_NON_NULL(iter);
+	M_REQUIRE_NON_NULL(extent);
+	if (iter->next >= iter->end) {
+		return 0;
+	}
+
+	uint16_t first = 0;
+	int error = extent_sector(iter, iter->next, &first);
+	if (error) {
+		return error;
+	}
+
+	// extend while the disk sectors follow (or the hole goes on)
+	int32_t length = 1;
+	while (iter->next + length < iter->end) {
+		uint16_t sect = 0;
+		error = extent_sector(iter, iter->next + length, &sect);
+		if (error) {
+			return error;
+		}
+		if (first == 0 ? sect != 0 : (uint32_t)sect != (uint32_t)first + (uint32_t)length) {
+			break;
+		}
+		++length;
+	}
+
+	extent->logical = iter->next;
+	extent->physical = first;
+	extent->length = length;
+	iter->next += length;
+	return 1;
+}
+
+
 int inode_alloc(struct unix_filesystem *u)
 {
 	M_REQUIRE_NON_NULL(u);
@@ -190,6 +458,10 @@ int inode_alloc(struct unix_filesystem *u)
 	if (next < 0) {
 		return ERR_NOMEM;
 	}
+	int error = mountv6_modify(u);
+	if (error) {
+		return error;
+	}
 	bm_set(u->ibm, (uint64_t)next);
 	return next;
 }
@@ -215,17 +487,94 @@ int inode_write(struct unix_filesystem *u, uint16_t inr, struct inode *inode)
 		return ERR_INODE_OUTOF_RANGE;
 	}
 
+	// a mapped disk is read-only
+	if (u->map != NULL) {
+		return ERR_READ_ONLY;
+	}
+	int error = mountv6_modify(u);
+	if (error) {
+		return error;
+	}
+
+	// write-back: keep it in the inode cache until inode_flush(),
+	// making room by writing back the other dirty inodes if needed
+	if (u->icache != NULL) {
+		struct icache_entry *entry = icache_insert(u->icache, inr, inode);
+		if (entry == NULL) {
+			error = inode_flush(u);
+			if (error) {
+				return error;
+			}
+			entry = icache_insert(u->icache, inr, inode);
+		}
+		if (entry != NULL) {
+			icache_mark_dirty(u->icache, entry);
+			icache_put(u->icache, entry);
+			return 0;
+		}
+		// every entry is pinned: write through
+	}
+
 	// load corresponding sector and check for error
-	int error = sector_read(u->f, u->s.s_inode_start + n_sector, &sector);
+	error = sector_read(u, u->s.s_inode_start + n_sector, &sector);
 	if (error) {
 		return error;
 	}
 
 	// change the inode
 	sector[n_inode] = *inode;
-	return sector_write(u->f, u->s.s_inode_start + n_sector, &sector);
+	return sector_write(u, u->s.s_inode_start + n_sector, &sector);
 }
 
 
+int inode_flush(const struct unix_filesystem *u)
+{
+	M_REQUIRE_NON_NULL(u);
+	if (u->icache == NULL) {
+		return 0;
+	}
+	size_t ndirty = icache_ndirty(u->icache);
+	if (ndirty == 0) {
+		return 0;
+	}
 
+	// dirty inodes sorted by number, thus grouped by table sector
+	// (those dirtied since they were counted wait for the next flush)
+	struct icache_entry **dirty = calloc(ndirty, sizeof(*dirty));
+	if (dirty == NULL) {
+		return ERR_NOMEM;
+	}
+	size_t count = icache_dirty(u->icache, dirty, ndirty);
+
+	int error = 0;
+	size_t first = 0;
+	while (first < count && !error) {
+		uint16_t n_sector = dirty[first]->inr / INODES_PER_SECTOR;
+		size_t last = first;
+		while (last < count && dirty[last]->inr / INODES_PER_SECTOR == n_sector) {
+			++last;
+		}
+
+		// one read-modify-write per sector, the read is useless if all changed
+		struct inode sector[INODES_PER_SECTOR];
+		if (last - first < INODES_PER_SECTOR) {
+			error = sector_read(u, u->s.s_inode_start + n_sector, sector);
+		}
+		if (!error) {
+			for (size_t i = first; i < last; ++i) {
+				sector[dirty[i]->inr % INODES_PER_SECTOR] = dirty[i]->inode;
+			}
+			error = sector_write(u, u->s.s_inode_start + n_sector, sector);
+		}
+		if (!error) {
+			for (size_t i = first; i < last; ++i) {
+				icache_mark_clean(u->icache, dirty[i]);
+			}
+			++u->icache->stats.writebacks;
+		}
+		first = last;
+	}
 
+	free(dirty);
+	return error;
+}
@@ -16,6 +16,44 @@
 extern "C" {
 #endif
 
+// Size above which the file is considered an extra large file
+#define EXTRA_LARGE_FILE (7*256*SECTOR_SIZE)
+
+#define INODE_MAP_EMPTY (-1)
+
+/**
+ * @brief decoded copy of the indirect block of a large file used last,
+ *        so that mapping its next sectors does not read it again
+ */
+struct inode_map {
+    int slot;                               /* index in i_addr, INODE_MAP_EMPTY if none */
+    uint16_t addr[ADDRESSES_PER_SECTOR];    /* content of the indirect block i_addr[slot] */
+};
+
+/**
+ * @brief run of sectors of a file that are contiguous on disk
+ *        (or a run of unallocated sectors, with physical set to 0)
+ */
+struct inode_extent {
+    int32_t logical;                        /* first sector within the file */
+    uint32_t physical;                      /* first sector on disk, 0 for a hole */
+    int32_t length;                         /* number of sectors */
+};
+
+/**
+ * @brief state of a walk over the extents of a file; see inode_extents_begin()
+ */
+struct inode_extent_iter {
+    const struct unix_filesystem *u;
+    const struct inode *inode;
+    struct inode_map *map;                  /* indirect block window, may be NULL */
+    int32_t next;                           /* next sector to report */
+    int32_t end;                            /* one past the last sector to report */
+    int32_t base;                           /* file sector of sectors[0] */
+    int32_t mapped;                         /* number of valid entries in sectors */
+    uint16_t sectors[ADDRESSES_PER_SECTOR];
+};
+
 /**
  * @brief Return the size of a file associated to a given inode.
  *
@@ -75,7 +113,7 @@ void inode_print(const struct inode *inode);
 int inode_scan_print(const struct unix_filesystem *u);
 
 /**
- * @brief read the content of an inode from disk
+ * @brief read the content of an inode from disk, or from the inode cache
  * @param u the filesystem (IN)
  * @param inr the inode number of the inode to read (IN)
  * @param inode the inode structure, read from disk (OUT)
@@ -83,6 +121,19 @@ int inode_scan_print(const struct unix_filesystem *u);
  */
 int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inode);
 
+/**
+ * @brief read the content of several inodes at once, each sector of the
+ *        inode table being read only once whatever the order of the numbers
+ * @param u the filesystem (IN)
+ * @param inrs the inode numbers of the inodes to read (IN)
+ * @param count the number of inodes
+ * @param inodes the inode structures, read from disk (OUT)
+ * @param errors for each inode, what inode_read() would have returned (OUT)
+ * @return 0 on success; <0 on error (then errors and inodes are not all set)
+ */
+int inode_read_many(const struct unix_filesystem *u, const uint16_t *inrs,
+                    size_t count, struct inode *inodes, int *errors);
+
 /**
  * @brief identify the sector that corresponds to a given portion of a file
  * @param u the filesystem (IN)
@@ -92,6 +143,42 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
  */
 int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off);
 
+/**
+ * @brief identify the sectors of a portion of a file at once
+ * @param u the filesystem (IN)
+ * @param i the inode (IN)
+ * @param map the indirect block window of this inode, kept between calls;
+ *        NULL if none (IN-OUT)
+ * @param first the offset within the file of the first sector (in sector-size units)
+ * @param count the number of sectors; first + count must not go past the end of file
+ * @param out the sectors on disk, 0 for unallocated ones (OUT)
+ * @return 0 on success; <0 error
+ */
+int inode_map_range(const struct unix_filesystem *u, const struct inode *i,
+                    struct inode_map *map, int32_t first, int32_t count, uint16_t *out);
+
+/**
+ * @brief start a walk over the extents of a portion of a file
+ * @param u the filesystem (IN)
+ * @param i the inode, which must outlive the walk (IN)
+ * @param map the indirect block window of this inode, NULL if none (IN-OUT)
+ * @param first the offset within the file of the first sector (in sector-size units)
+ * @param count the number of sectors; first + count must not go past the end of file
+ * @param iter the walk to initialize (OUT)
+ * @return 0 on success; <0 error
+ */
+int inode_extents_begin(const struct unix_filesystem *u, const struct inode *i,
+                        struct inode_map *map, int32_t first, int32_t count,
+                        struct inode_extent_iter *iter);
+
+/**
+ * @brief report the next extent of a walk, as long as possible
+ * @param iter the walk (IN-OUT)
+ * @param extent the extent (OUT)
+ * @return 1 if an extent was reported; 0 at the end of the walk; <0 error
+ */
+int inode_extent_next(struct inode_extent_iter *iter, struct inode_extent *extent);
+
 /**
  * @brief alloc a new inode (returns its inr if possible)
  * @param u the filesystem (IN)
@@ -100,7 +187,8 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
 int inode_alloc(struct unix_filesystem *u);
 
 /**
- * @brief write the content of an inode to disk
+ * @brief write the content of an inode to disk; with the inode cache, it is
+ *        only written back by inode_flush() (or when room is needed)
  * @param u the filesystem (IN)
  * @param inr the inode number of the inode to read (IN)
  * @param inode the inode structure, read from disk (IN)
@@ -108,6 +196,14 @@ int inode_alloc(struct unix_filesystem *u);
  */
 int inode_write(struct unix_filesystem *u, uint16_t inr, struct inode *inode);
 
+/**
+ * @brief write back the inodes modified in the inode cache, one write
+ *        per sector of the inode table
+ * @param u the filesystem (IN)
+ * @return 0 on success; <0 on error
+ */
+int inode_flush(const struct unix_filesystem *u);
+
 #ifdef __cplusplus
 }
 #endif
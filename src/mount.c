@@ -1,102 +1,440 @@
 
 #include <inttypes.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mount.h"
 #include "sector.h"
 #include "error.h"
 #include "bmblock.h"
 #include "inode.h"
+#include "aio.h"
+
+#define BITS_PER_SECTOR (SECTOR_SIZE * 8)
+#define SCAN_BATCH 64 /* inode sectors read at once when rebuilding the bitmaps */
+#define MAX_SCAN_THREADS 16
+#define SCAN_DEPTH 4 /* batches of inode sectors in flight during a scan */
+
+/*
+ * Values of s_fmod: the bitmap regions are only trusted after a clean
+ * umount, images written by other tools leave them empty with s_fmod == 0
+ */
+#define FMOD_UNKNOWN    0   /* bitmap regions never written: rebuild */
+#define FMOD_MOUNTED    1   /* in use or not cleanly unmounted: rebuild */
+#define FMOD_CLEAN      2   /* bitmap regions are up to date */
 
 
 /**
- * Fill ibm and fbm of a unix_filesystem struct
- * @param OUT u
+ * Mark in fbm the sectors used by an allocated inode: its data sectors
+ * and, for large files, the indirect sectors themselves; each indirect
+ * sector is read only once
+ * @param IN u, inode
+ * @param OUT fbm, sectors_read (incremented)
+ * @return 0 on success; <0 on error
  */
-void fill_ibm(struct unix_filesystem * u)
+static int mark_inode_sectors(const struct unix_filesystem *u, const struct inode *inode,
+			      struct bmblock_array *fbm, uint32_t *sectors_read)
 {
-	// Test if u is NULL
-	if (!u) {
-		return;;
+	int32_t size = inode_getsize(inode);
+	int32_t n_sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+	// small file: i_addr holds the data sectors
+	if (size < ADDR_SMALL_LENGTH * SECTOR_SIZE) {
+		for (int32_t k = 0; k < n_sectors && inode->i_addr[k] != 0; ++k) {
+			bm_set(fbm, inode->i_addr[k]);
+		}
+		return 0;
 	}
 
-	// create a table containing the sector
-	struct inode sector[INODES_PER_SECTOR];
+	// large file: i_addr holds indirect sectors of ADDRESSES_PER_SECTOR entries
+	for (int32_t k = 0; k < ADDR_SMALL_LENGTH && n_sectors > 0; ++k) {
+		if (inode->i_addr[k] == 0) {
+			break;
+		}
+		bm_set(fbm, inode->i_addr[k]);
 
-	for(uint16_t i = 0; i < u->s.s_isize; ++i) {
-		// read the sector, and keep the error if any
-		int error = sector_read(u->f,(uint32_t) u->s.s_inode_start + i, sector);
-		if (error != 0) {
-			return;
+		uint16_t addresses[ADDRESSES_PER_SECTOR];
+		int error = sector_read(u, inode->i_addr[k], addresses);
+		if (error) {
+			return error;
+		}
+		++*sectors_read;
+
+		for (int32_t e = 0; e < ADDRESSES_PER_SECTOR && e < n_sectors; ++e) {
+			if (addresses[e] != 0) {
+				bm_set(fbm, addresses[e]);
+			}
 		}
+		n_sectors -= ADDRESSES_PER_SECTOR;
+	}
+	return 0;
+}
+
+
+/**
+ * Fill ibm and fbm from the given sectors of the inode table, in a single
+ * pass; the table is read SCAN_BATCH sectors at a time, with SCAN_DEPTH
+ * batches in flight if an I/O engine is given
+ * @param IN u, aio (may be NULL), first, count
+ * @param OUT ibm, fbm, sectors_read (incremented)
+ * @return 0 on success; <0 on error
+ */
+static int fill_bitmaps_range(const struct unix_filesystem *u, struct aio_engine *aio,
+			      uint16_t first, uint16_t count,
+			      struct bmblock_array *ibm, struct bmblock_array *fbm,
+			      uint32_t *sectors_read)
+{
+	size_t depth = (aio != NULL) ? SCAN_DEPTH : 1;
+	struct inode *tables = malloc(depth * SCAN_BATCH * SECTOR_SIZE);
+	if (tables == NULL) {
+		return ERR_NOMEM;
+	}
+	struct aio_batch batches[SCAN_DEPTH];
+	for (size_t k = 0; k < depth; ++k) {
+		aio_batch_init(&batches[k]);
+	}
 
-		for (size_t j = 0; j < 16; ++j) {
+	int error = 0;
+	uint32_t end = (uint32_t)first + count;
+	uint32_t submitted = first;
+	size_t slot = 0;
+	for (uint32_t i = first; i < end && !error; i += SCAN_BATCH) {
+		uint32_t batch = end - i;
+		if (batch > SCAN_BATCH) {
+			batch = SCAN_BATCH;
+		}
+		struct inode *table = tables;
+
+		if (aio == NULL) {
+			// read the batch of inode sectors at once
+			struct iovec iov = { table, batch * SECTOR_SIZE };
+			error = sector_readv(u, u->s.s_inode_start + i, &iov, 1);
+		} else {
+			// keep the next batches in flight while this one is decoded
+			while (!error && submitted < end && submitted < i + depth * SCAN_BATCH) {
+				size_t k = ((submitted - first) / SCAN_BATCH) % depth;
+				uint32_t n = end - submitted < SCAN_BATCH ? end - submitted : SCAN_BATCH;
+				aio_batch_free(&batches[k]);
+				error = aio_batch_add(&batches[k], u->s.s_inode_start + submitted, n,
+						      tables + k * SCAN_BATCH * INODES_PER_SECTOR, 0);
+				if (!error) {
+					error = aio_submit(aio, &batches[k]);
+				}
+				submitted += n;
+			}
+			int waited = aio_wait(aio, &batches[slot]);
+			error = error ? error : waited;
+			table = tables + slot * SCAN_BATCH * INODES_PER_SECTOR;
+			slot = (slot + 1) % depth;
+		}
+		*sectors_read += batch;
+
+		for (size_t j = 0; j < batch * INODES_PER_SECTOR && !error; ++j) {
 			// If current inode is allocated
-			if(sector[j].i_mode & IALLOC) {
-				bm_set(u->ibm, i*INODES_PER_SECTOR + j);
+			if (table[j].i_mode & IALLOC) {
+				bm_set(ibm, i * INODES_PER_SECTOR + j);
+				error = mark_inode_sectors(u, &table[j], fbm, sectors_read);
+			}
+		}
+	}
+
+	// nothing may still be writing into tables
+	if (aio != NULL) {
+		for (size_t k = 0; k < depth; ++k) {
+			if (batches[k].count > 0) {
+				(void)aio_wait(aio, &batches[k]);
 			}
+			aio_batch_free(&batches[k]);
 		}
 	}
-	return;
+	free(tables);
+	return error;
 }
 
 
-void fill_fbm(struct unix_filesystem *u)
+/**
+ * Part of the inode table scanned by one thread, into its own bitmaps
+ */
+struct scan_job {
+	const struct unix_filesystem *u;
+	uint16_t first;
+	uint16_t count;
+	struct bmblock_array *ibm;
+	struct bmblock_array *fbm;
+	uint32_t sectors_read;
+	int error;
+	pthread_t thread;
+};
+
+
+static void *scan_worker(void *arg)
 {
-	// Test if u is NULL
-	if (!u) {
-		return;
+	struct scan_job *job = arg;
+	job->error = fill_bitmaps_range(job->u, NULL, job->first, job->count,
+					job->ibm, job->fbm, &(job->sectors_read));
+	return NULL;
+}
+
+
+/**
+ * Fill ibm and fbm of a unix_filesystem struct by scanning the inode table;
+ * the table is split among several threads, each building partial bitmaps
+ * that are OR-ed into u's at the end
+ * @param OUT u
+ * @param IN threads the maximum number of threads
+ * @param IN io_threads the I/O threads of a single-threaded scan
+ * @return 0 on success; <0 on error
+ */
+static int fill_bitmaps(struct unix_filesystem *u, unsigned int threads,
+			unsigned int io_threads)
+{
+	// at least SCAN_BATCH sectors per thread, and stdio cannot be shared
+	unsigned int max_threads = u->s.s_isize / SCAN_BATCH;
+	if (threads > max_threads) {
+		threads = max_threads;
+	}
+	if (threads > MAX_SCAN_THREADS) {
+		threads = MAX_SCAN_THREADS;
+	}
+	if (threads < 2 || u->io_mode == SECTOR_IO_STDIO) {
+		u->stats.threads = 1;
+		// the engine only lives during the scan: no thread may outlive
+		// the mount (e.g. across the fork of a daemon)
+		struct aio_engine *aio = aio_alloc(u, io_threads);
+		if (aio == NULL) {
+			return ERR_NOMEM;
+		}
+		int error = fill_bitmaps_range(u, aio, 0, u->s.s_isize, u->ibm, u->fbm,
+					       &(u->stats.sectors_read));
+		aio_free(aio);
+		return error;
 	}
 
+	// job 0 works on u's bitmaps in this thread, the others on copies
+	struct scan_job jobs[MAX_SCAN_THREADS];
+	memset(jobs, 0, sizeof(jobs));
+	uint16_t first = 0;
+	for (unsigned int t = 0; t < threads; ++t) {
+		jobs[t].u = u;
+		jobs[t].first = first;
+		jobs[t].count = (uint16_t)((u->s.s_isize - first) / (threads - t));
+		first = (uint16_t)(first + jobs[t].count);
+		if (t == 0) {
+			jobs[t].ibm = u->ibm;
+			jobs[t].fbm = u->fbm;
+		} else {
+			jobs[t].ibm = bm_alloc(u->ibm->min, u->ibm->max);
+			jobs[t].fbm = bm_alloc(u->fbm->min, u->fbm->max);
+			if (jobs[t].ibm == NULL || jobs[t].fbm == NULL) {
+				jobs[t].error = ERR_NOMEM;
+			}
+		}
+	}
 
-	// create a table containing the sector
-	struct inode sector[INODES_PER_SECTOR];
+	unsigned int started = 1;
+	for (; started < threads; ++started) {
+		if (jobs[started].error
+		    || pthread_create(&jobs[started].thread, NULL, scan_worker, &jobs[started])) {
+			break;
+		}
+	}
+	scan_worker(&jobs[0]);
+
+	int error = jobs[0].error;
+	u->stats.sectors_read += jobs[0].sectors_read;
+	for (unsigned int t = 1; t < threads; ++t) {
+		if (t < started) {
+			pthread_join(jobs[t].thread, NULL);
+		} else if (!jobs[t].error) {
+			// could not be started
+			jobs[t].error = ERR_NOMEM;
+		}
+		if (!error) {
+			error = jobs[t].error ? jobs[t].error : bm_or(u->ibm, jobs[t].ibm);
+		}
+		if (!error) {
+			error = bm_or(u->fbm, jobs[t].fbm);
+		}
+		u->stats.sectors_read += jobs[t].sectors_read;
+		free(jobs[t].ibm);
+		free(jobs[t].fbm);
+	}
 
-	for(uint16_t i = 0; i < u->s.s_isize; ++i) {
-		// read the sector, and keep the error if any
-		int error = sector_read(u->f,(uint32_t) u->s.s_inode_start + i, sector);
-		if (error != 0) {
+	u->stats.threads = threads;
+	return error;
+}
+
+
+/**
+ * Map the whole disk read-only for SECTOR_IO_MMAP;
+ * use positional I/O instead if it cannot be mapped
+ * @param IN-OUT u
+ */
+static void map_disk(struct unix_filesystem *u)
+{
+	struct stat st;
+	if (fstat(u->fd, &st) == 0 && st.st_size > 0) {
+		void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, u->fd, 0);
+		if (map != MAP_FAILED) {
+			u->map = map;
+			u->map_size = (size_t)st.st_size;
 			return;
 		}
+	}
+	u->io_mode = SECTOR_IO_PREAD;
+}
 
-		for (size_t j = 0; j < 16; ++j) {
-			// If current inode is allocated
-			if(sector[j].i_mode & IALLOC) {
-				int index = 0, n_sect = 0;
-				do {
-					n_sect = inode_findsector(u, &(sector[j]), index);
-					if (n_sect > 0) {
-						bm_set(u->fbm, (uint64_t) n_sect);
-					}
-					++ index;
-				} while (n_sect > 0);
+
+void mountv6_default_options(struct mountv6_options *opts)
+{
+	// Test argument
+	if (opts == NULL) {
+		return;
+	}
+
+	memset(opts, 0, sizeof(*opts));
+	opts->io_mode = SECTOR_IO_PREAD;
+	opts->cache_sectors = BCACHE_DEFAULT_SIZE;
+	opts->dirty_sectors = BCACHE_DEFAULT_DIRTY;
+	opts->dirty_age_ms = BCACHE_DEFAULT_AGE_MS;
+	opts->cache_inodes = ICACHE_DEFAULT_SIZE;
+	opts->cache_dentries = DCACHE_DEFAULT_SIZE;
+	opts->indexed_dirs = DINDEX_DEFAULT_SIZE;
+	opts->readahead_sectors = READAHEAD_DEFAULT_SECTORS;
+	opts->io_threads = AIO_DEFAULT_THREADS;
+	opts->alloc_policy = BM_NEXT_FIT;
+}
+
+
+/**
+ * Tell whether the superblock reserves a region able to hold a bitmap
+ * of values up to max
+ */
+static int bitmap_region_ok(const struct unix_filesystem *u, uint16_t start,
+			    uint16_t size, uint64_t max)
+{
+	return start > SUPERBLOCK_SECTOR && size > 0
+	       && (uint64_t)size * BITS_PER_SECTOR > max
+	       && (uint32_t)start + size <= u->s.s_fsize;
+}
+
+
+/**
+ * Tell whether ibm and fbm are saved on disk (s_fbm_start, s_ibm_start)
+ */
+static int bitmaps_on_disk(const struct unix_filesystem *u)
+{
+	return u->fbm != NULL && u->ibm != NULL
+	       && bitmap_region_ok(u, u->s.s_fbm_start, u->s.s_fbmsize, u->fbm->max)
+	       && bitmap_region_ok(u, u->s.s_ibm_start, u->s.s_ibmsize, u->ibm->max);
+}
+
+
+/**
+ * Load a bitmap from its region on disk; bit k of the region
+ * (bit k%8 of byte k/8) stands for the value k
+ */
+static int bitmap_load(const struct unix_filesystem *u, struct bmblock_array *bm,
+		       uint16_t start, uint16_t size)
+{
+	uint8_t *region = malloc((size_t)size * SECTOR_SIZE);
+	if (region == NULL) {
+		return ERR_NOMEM;
+	}
+
+	// the whole region in a single read
+	struct iovec iov = { region, (size_t)size * SECTOR_SIZE };
+	int error = sector_readv(u, start, &iov, 1);
+	if (!error) {
+		for (uint64_t x = bm->min; x <= bm->max; ++x) {
+			if (region[x / 8] & (1 << (x % 8))) {
+				bm_set(bm, x);
 			}
 		}
 	}
 
+	free(region);
+	return error;
+}
+
+
+/**
+ * Save a bitmap to its region on disk (same format as bitmap_load)
+ */
+static int bitmap_store(const struct unix_filesystem *u, struct bmblock_array *bm,
+			uint16_t start, uint16_t size)
+{
+	uint8_t *region = calloc(size, SECTOR_SIZE);
+	if (region == NULL) {
+		return ERR_NOMEM;
+	}
+
+	for (uint64_t x = bm->min; x <= bm->max; ++x) {
+		if (bm_get(bm, x) == 1) {
+			region[x / 8] = (uint8_t)(region[x / 8] | (1 << (x % 8)));
+		}
+	}
+
+	struct iovec iov = { region, (size_t)size * SECTOR_SIZE };
+	int error = sector_writev(u, start, &iov, 1);
+
+	free(region);
+	return error;
 }
 
 
 int mountv6(const char *filename, struct unix_filesystem *u)
+{
+	return mountv6_opts(filename, u, NULL);
+}
+
+
+int mountv6_opts(const char *filename, struct unix_filesystem *u,
+		 const struct mountv6_options *opts)
 {
 	// Test arguments
 	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(filename);
 
+	struct mountv6_options defaults;
+	if (opts == NULL) {
+		mountv6_default_options(&defaults);
+		opts = &defaults;
+	}
+
 	// Set to 0 all the unix_filesystem structure
 	memset(u, 0, sizeof(*u));
 	u->fbm = NULL;
 	u->ibm = NULL;
 
-	// open the file u->f
-	u->f = fopen(filename, "r+");
+	// open the file u->f (the memory-mapped mode is read-only)
+	u->f = fopen(filename, opts->io_mode == SECTOR_IO_MMAP ? "r" : "r+");
 	if(u->f == NULL) {
 		return ERR_IO;
 	}
+	// lives as long as u->f: umountv6 destroys it
+	pthread_rwlock_init(&u->lock, NULL);
+
+	// positional I/O and mmap need the descriptor behind the FILE*
+	u->fd = fileno(u->f);
+	u->io_mode = (u->fd < 0) ? SECTOR_IO_STDIO : opts->io_mode;
+	u->alloc_policy = opts->alloc_policy;
+	if (u->io_mode == SECTOR_IO_MMAP) {
+		map_disk(u);
+	}
 
 	// boot_sector will recieve the sector 512 bytes
 	uint8_t boot_sector[SECTOR_SIZE];
 	// load the first sector into boot_sector and return the error if any
-	int error = sector_read(u->f, BOOTBLOCK_SECTOR, boot_sector);
+	int error = sector_read(u, BOOTBLOCK_SECTOR, boot_sector);
+	if (error == ERR_IO && u->io_mode == SECTOR_IO_PREAD) {
+		// the disk does not support pread (e.g. not seekable): fall back to stdio
+		u->io_mode = SECTOR_IO_STDIO;
+		error = sector_read(u, BOOTBLOCK_SECTOR, boot_sector);
+	}
 	if( error != 0) {
 		return error;
 	}
@@ -107,13 +445,13 @@ int mountv6(const char *filename, struct unix_filesystem *u)
 	}
 
 	// read the superblock
-	error = sector_read(u->f, SUPERBLOCK_SECTOR, &(u->s));
+	error = sector_read(u, SUPERBLOCK_SECTOR, &(u->s));
 	if (error) {
 		return error;
 	}
 
 	// allocate ibm and fbm
-	u->ibm = bm_alloc(u->s.s_inode_start,
+	u->ibm = bm_alloc(ROOT_INUMBER,
 			  (uint64_t)(u->s.s_isize * INODES_PER_SECTOR) - 1);
 	u->fbm = bm_alloc(u->s.s_block_start + 1, u->s.s_fsize - 1);
 
@@ -123,11 +461,97 @@ int mountv6(const char *filename, struct unix_filesystem *u)
 		return ERR_IO;
 	}
 
-	fill_ibm(u);
-	fill_fbm(u);
+	// bitmaps are saved on disk by a clean umount, else rebuilt from the inodes
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 
-	// return sector_read code
-	return error;
+	if (bitmaps_on_disk(u) && u->s.s_fmod == FMOD_CLEAN) {
+		u->stats.bitmaps_loaded = 1;
+		u->stats.sectors_read = (uint32_t)(u->s.s_fbmsize + u->s.s_ibmsize);
+		error = bitmap_load(u, u->fbm, u->s.s_fbm_start, u->s.s_fbmsize);
+		if (!error) {
+			error = bitmap_load(u, u->ibm, u->s.s_ibm_start, u->s.s_ibmsize);
+		}
+	} else {
+		unsigned int threads = opts->scan_threads;
+		if (threads == 0) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			threads = cpus > 0 ? (unsigned int)cpus : 1;
+		}
+		error = fill_bitmaps(u, threads, opts->io_threads);
+	}
+	if (error) {
+		return error;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	u->stats.bitmap_ns = (uint64_t)(end.tv_sec - begin.tv_sec) * 1000000000u
+			     + (uint64_t)end.tv_nsec - (uint64_t)begin.tv_nsec;
+	debug_print("[OK] bitmaps %s in %" PRIu64 " ns, %" PRIu32 " sectors read by %u thread(s)\n",
+		    u->stats.bitmaps_loaded ? "loaded" : "rebuilt",
+		    u->stats.bitmap_ns, u->stats.sectors_read, u->stats.threads);
+
+	// the cache is attached once the mount-time scan is over
+	// (a mapped disk is already in memory)
+	if (opts->cache_sectors > 0 && u->map == NULL) {
+		u->cache = bcache_alloc(opts->cache_sectors);
+		if (u->cache == NULL) {
+			return ERR_NOMEM;
+		}
+		// keep at least half of the buffers clean for the reads
+		u->cache->dirty_max = opts->dirty_sectors;
+		if (u->cache->dirty_max > u->cache->capacity / 2) {
+			u->cache->dirty_max = u->cache->capacity / 2;
+		}
+		u->cache->dirty_age_ns = (uint64_t)opts->dirty_age_ms * 1000000u;
+	}
+	// what is read ahead must not push the rest out of the cache
+	u->readahead_max = opts->readahead_sectors > 0 ? opts->readahead_sectors : 0;
+	if (u->cache != NULL && (size_t)u->readahead_max > u->cache->capacity / 4) {
+		u->readahead_max = (int32_t)(u->cache->capacity / 4);
+	}
+	if (opts->cache_inodes > 0) {
+		u->icache = icache_alloc(opts->cache_inodes);
+		if (u->icache == NULL) {
+			return ERR_NOMEM;
+		}
+	}
+	if (opts->cache_dentries > 0) {
+		u->dcache = dcache_alloc(opts->cache_dentries);
+		if (u->dcache == NULL) {
+			return ERR_NOMEM;
+		}
+	}
+	if (opts->indexed_dirs > 0) {
+		u->dindex = dindex_alloc(opts->indexed_dirs);
+		if (u->dindex == NULL) {
+			return ERR_NOMEM;
+		}
+	}
+
+	// from now on, umountv6 may save the bitmaps
+	u->mounted = 1;
+	return 0;
+}
+
+
+void mountv6_print_stats(const struct unix_filesystem *u)
+{
+	// if pointer is NULL
+	if(u == NULL) {
+		return;
+	}
+
+	printf("**********MOUNT STATS START**********\n");
+	printf("bitmaps\t\t: %s\n", u->stats.bitmaps_loaded ? "loaded" : "rebuilt");
+	printf("sectors read\t: %" PRIu32 "\n", u->stats.sectors_read);
+	printf("threads\t\t: %u\n", u->stats.threads);
+	printf("time\t\t: %" PRIu64 " us\n", u->stats.bitmap_ns / 1000);
+	printf("**********MOUNT STATS END************\n");
+	bcache_print_stats(u->cache);
+	icache_print_stats(u->icache);
+	dcache_print_stats(u->dcache);
+	dindex_print_stats(u->dindex);
 }
 
 
@@ -166,23 +590,109 @@ int umountv6(struct unix_filesystem *u)
 	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(u->f);
 
+	if (u->map != NULL) {
+		munmap((void *)(uintptr_t)u->map, u->map_size);
+		u->map = NULL;
+	}
+
+	// save the bitmaps and mark the filesystem clean, if it was changed
+	int error = mountv6_sync(u);
+	if (!error && u->mounted && u->modified && bitmaps_on_disk(u)) {
+		u->s.s_fmod = FMOD_CLEAN;
+		error = sector_write(u, SUPERBLOCK_SECTOR, &(u->s));
+		// last, once everything else is on the disk
+		if (!error) {
+			error = sector_flush(u);
+		}
+	}
+
 	// if error during closing return ERR_IO, else 0
-	int error = fclose(u->f);
-	if (error) {
-		return ERR_IO;
+	if (fclose(u->f) && !error) {
+		error = ERR_IO;
 	}
+	u->f = NULL;
+	pthread_rwlock_destroy(&u->lock);
 
-	// free fbm and ibm
+	// free fbm, ibm and the cache
 	free(u->fbm);
 	free(u->ibm);
+	bcache_free(u->cache);
+	icache_free(u->icache);
+	dcache_free(u->dcache);
+	dindex_free(u->dindex);
 
 	u->fbm = NULL;
 	u->ibm = NULL;
+	u->cache = NULL;
+	u->icache = NULL;
+	u->dcache = NULL;
+	u->dindex = NULL;
+	u->mounted = 0;
+	u->modified = 0;
+
+	return error;
+}
+
 
+int mountv6_modify(struct unix_filesystem *u)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+
+	if (u->modified) {
+		return 0;
+	}
+	// a mapped disk is read-only
+	if (u->map != NULL) {
+		return ERR_READ_ONLY;
+	}
+	u->modified = 1;
+
+	// the saved bitmaps are stale until the next clean umount: this must
+	// reach the disk before any of the changes
+	if (bitmaps_on_disk(u) && u->s.s_fmod != FMOD_MOUNTED) {
+		u->s.s_fmod = FMOD_MOUNTED;
+		int error = sector_write(u, SUPERBLOCK_SECTOR, &(u->s));
+		if (!error) {
+			error = sector_flush(u);
+		}
+		if (error) {
+			u->modified = 0;
+			return error;
+		}
+	}
 	return 0;
 }
 
 
+int mountv6_sync(struct unix_filesystem *u)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+
+	// the inode table first, it does not depend on the bitmap regions
+	int error = inode_flush(u);
+	if (error) {
+		return error;
+	}
+
+	// the bitmaps, if they have changed and have regions
+	// (after a failed mount, they are incomplete: leave the saved ones)
+	if (u->mounted && u->modified && bitmaps_on_disk(u)) {
+		error = bitmap_store(u, u->fbm, u->s.s_fbm_start, u->s.s_fbmsize);
+		if (!error) {
+			error = bitmap_store(u, u->ibm, u->s.s_ibm_start, u->s.s_ibmsize);
+		}
+		if (error) {
+			return error;
+		}
+	}
+
+	// then all the sectors still dirty in the buffer cache
+	return sector_flush(u);
+}
+
+
 
 int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
 {
@@ -196,8 +706,19 @@ int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
 	if (s.s_fsize < (s.s_isize + num_inodes)) {
 		return ERR_NOT_ENOUGH_BLOCS;
 	}
-	s.s_inode_start = SUPERBLOCK_SECTOR + 1;
+	// bitmaps regions, then inodes, then data
+	s.s_fbm_start = SUPERBLOCK_SECTOR + 1;
+	s.s_fbmsize = (uint16_t)((num_blocks + BITS_PER_SECTOR - 1) / BITS_PER_SECTOR);
+	s.s_ibm_start = s.s_fbm_start + s.s_fbmsize;
+	s.s_ibmsize = (uint16_t)((s.s_isize * INODES_PER_SECTOR + BITS_PER_SECTOR - 1)
+				 / BITS_PER_SECTOR);
+	s.s_inode_start = s.s_ibm_start + s.s_ibmsize;
 	s.s_block_start = s.s_inode_start + s.s_isize;
+	if (s.s_block_start >= s.s_fsize) {
+		return ERR_NOT_ENOUGH_BLOCS;
+	}
+	// the (empty) saved bitmaps are not valid yet: rebuilt at first mount
+	s.s_fmod = FMOD_UNKNOWN;
 
 	// Open file on disk and test if f has NULL value
 	FILE* f = fopen(filename ,"w");
@@ -219,23 +740,37 @@ int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
 		return  ERR_IO;
 	}
 
+	// empty bitmap regions
+	uint8_t zero[SECTOR_SIZE] = {0};
+	size_t written = 1;
+	size_t index = 0;
+	while (written == 1 && index < (size_t)(s.s_fbmsize + s.s_ibmsize)) {
+		written = fwrite(zero, SECTOR_SIZE, 1, f);
+		++ index;
+	}
+	if (written != 1) {
+		fclose(f);
+		return ERR_IO;
+	}
 
 	struct inode inodes[INODES_PER_SECTOR] = {};
 	inodes[ROOT_INUMBER].i_mode = IALLOC | IFDIR;
 
-	return_code = fwrite(&inodes, SECTOR_SIZE, 1, f);
-	size_t index = 0;
-	size_t tot_inodes = s.s_inode_start + s.s_block_start;
-	// number of sector needed (counting inonde 0 and root inode => +2)
-	size_t n_inode_sector = (tot_inodes+2) / INODES_PER_SECTOR;
+	if (return_code == 1) {
+		return_code = fwrite(&inodes, SECTOR_SIZE, 1, f);
+	}
+	index = 1;
 
+	// the other sectors of inodes
 	memset(&inodes, 0, SECTOR_SIZE);
-	while (return_code == 1 && index < n_inode_sector) {
+	while (return_code == 1 && index < s.s_isize) {
 		return_code = fwrite(inodes, SECTOR_SIZE, 1, f);
 		++ index;
 	}
 
-	fclose(f);
+	if (fclose(f) || return_code != 1) {
+		return ERR_IO;
+	}
 	f = NULL;
 
 	return 0;
@@ -9,20 +9,93 @@
  */
 
 #include <stdio.h>
+#include <pthread.h>
 #include "unixv6fs.h"
 #include "bmblock.h"
+#include "sector.h"
+#include "bcache.h"
+#include "icache.h"
+#include "dcache.h"
+#include "dindex.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define READAHEAD_DEFAULT_SECTORS 128 /* 64 KB */
+
+/**
+ * @brief cost of setting up the bitmaps at mount time
+ */
+struct mountv6_stats {
+    int bitmaps_loaded;            /* 1: read from their disk regions, 0: rebuilt from the inodes */
+    uint32_t sectors_read;         /* number of sectors read to set them up */
+    unsigned int threads;          /* number of threads that rebuilt them */
+    uint64_t bitmap_ns;            /* time spent, in nanoseconds */
+};
+
+/*
+ * Threads: the functions of the library do not lock u->lock themselves.
+ * Callers hold it for reading around lookups and reads, and for writing
+ * around anything that modifies the filesystem (superblock, bitmaps,
+ * inodes, directories, data) as well as sync and umount. Under a read
+ * lock, the caches (buffers, inodes, dentries, directory indexes) are
+ * shared safely: each one has its own lock.
+ */
 struct unix_filesystem {
+    pthread_rwlock_t lock;         /* readers and writer of the filesystem, see above */
     FILE *f;
+    int fd;                        /* descriptor of f, used by positional I/O */
+    enum sector_io_mode io_mode;   /* how the sector layer accesses the disk */
+    const uint8_t *map;            /* whole disk, in SECTOR_IO_MMAP mode */
+    size_t map_size;               /* size of the mapping in bytes */
     struct superblock s;           /* copy of the superblock */
     struct bmblock_array *fbm;     /* block bitmmap -- ignore before WEEK 10 */
     struct bmblock_array *ibm;     /* inode bitmap  -- ignore before WEEK 10 */
+    struct bcache *cache;          /* buffer cache of sectors, NULL if disabled */
+    struct icache *icache;         /* cache of inodes, NULL if disabled */
+    struct dcache *dcache;         /* cache of directory entries, NULL if disabled */
+    struct dindex *dindex;         /* hash indexes of directories, NULL if disabled */
+    enum bm_policy alloc_policy;   /* how runs of data blocks are picked in fbm */
+    int32_t readahead_max;         /* largest readahead window of a file, in sectors */
+    struct mountv6_stats stats;    /* mount latency report */
+    int mounted;                   /* 1 once mountv6_opts() has succeeded */
+    int modified;                  /* 1 once the bitmaps or inodes have changed */
 };
 
+/**
+ * @brief tunables of a mount; see mountv6_default_options()
+ */
+struct mountv6_options {
+    enum sector_io_mode io_mode;   /* preferred disk backend */
+    size_t cache_sectors;          /* size of the buffer cache, 0 disables it */
+    size_t dirty_sectors;          /* dirty sectors triggering a write-back, 0: write-through */
+    unsigned int dirty_age_ms;     /* age of a dirty sector triggering a write-back */
+    size_t cache_inodes;           /* size of the inode cache, 0 disables it */
+    size_t cache_dentries;         /* size of the dentry cache, 0 disables it */
+    size_t indexed_dirs;           /* directories indexed at once, 0 disables the indexes */
+    enum bm_policy alloc_policy;   /* block allocation policy */
+    unsigned int scan_threads;     /* threads rebuilding the bitmaps, 0: one per CPU */
+    int32_t readahead_sectors;     /* largest readahead window, 0 disables readahead */
+    unsigned int io_threads;       /* I/O threads of the mount-time scan, 0: synchronous */
+};
+
+/**
+ * @brief fill the given options with the defaults used by mountv6()
+ * @param opts the options (OUT)
+ */
+void mountv6_default_options(struct mountv6_options *opts);
+
+/**
+ * @brief  mount a unix v6 filesystem with the given options
+ * @param filename name of the unixv6 filesystem on the underlying disk (IN)
+ * @param u the filesystem (OUT)
+ * @param opts the mount options, NULL for the defaults (IN)
+ * @return 0 on success; <0 on error
+ */
+int mountv6_opts(const char *filename, struct unix_filesystem *u,
+                 const struct mountv6_options *opts);
+
 /**
  * @brief  mount a unix v6 filesystem
  * @param filename name of the unixv6 filesystem on the underlying disk (IN)
@@ -31,12 +104,35 @@ struct unix_filesystem {
  */
 int mountv6(const char *filename, struct unix_filesystem *u);
 
+/**
+ * @brief print to stdout the mount time statistics and the cache counters
+ * @param u - the mounted filesytem
+ */
+void mountv6_print_stats(const struct unix_filesystem *u);
+
 /**
  * @brief print to stdout the content of the superblock
  * @param u - the mounted filesytem
  */
 void mountv6_print_superblock(const struct unix_filesystem *u);
 
+/**
+ * @brief to be called before the first change to the bitmaps or the inodes:
+ *        marks the filesystem as in use on disk (s_fmod), so that the saved
+ *        bitmaps are not trusted if it is not cleanly unmounted
+ * @param u - the mounted filesytem
+ * @return 0 on success; <0 on error
+ */
+int mountv6_modify(struct unix_filesystem *u);
+
+/**
+ * @brief write back the in-memory state of the filesystem (inodes, bitmaps,
+ *        dirty sectors of the buffer cache) to disk
+ * @param u - the mounted filesytem
+ * @return 0 on success; <0 on error
+ */
+int mountv6_sync(struct unix_filesystem *u);
+
 /**
  * @brief umount the given filesystem
  * @param u - the mounted filesytem
@@ -1,52 +1,426 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <pthread.h>
 #include "sector.h"
+#include "mount.h"
+#include "bcache.h"
 #include "unixv6fs.h"
 #include "error.h"
 
+// limits.h only exports it in XSI mode; 1024 is the Linux value
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-int sector_read(FILE *f, uint32_t sector, void *data)
+#define PREFETCH_BATCH 32 /* sectors read at once by sector_prefetch */
+
+/**
+ * @brief monotonic time in nanoseconds, for the age of dirty sectors
+ */
+static uint64_t now_ns(void)
 {
-	// Test arguments
-	M_REQUIRE_NON_NULL(f);
-	M_REQUIRE_NON_NULL(data);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
 
-	// compute the offset to read
-	uint32_t position = sector * SECTOR_SIZE;
 
+/**
+ * @brief total length of a vector of buffers
+ * @return the length in bytes, or 0 if it is not made of whole sectors
+ */
+static size_t iov_length(const struct iovec *iov, int iovcnt)
+{
+	size_t length = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		length += iov[i].iov_len;
+	}
+	return (length % SECTOR_SIZE == 0) ? length : 0;
+}
+
+
+/**
+ * @brief the bytes [offset, offset + len) of a vector of buffers
+ * @param out room for iovcnt buffers (OUT)
+ * @return the number of buffers stored in out
+ */
+static int iov_slice(const struct iovec *iov, int iovcnt, size_t offset,
+		     size_t len, struct iovec *out)
+{
+	int count = 0;
+	for (int i = 0; i < iovcnt && len > 0; ++i) {
+		if (offset >= iov[i].iov_len) {
+			offset -= iov[i].iov_len;
+			continue;
+		}
+		size_t take = iov[i].iov_len - offset;
+		if (take > len) {
+			take = len;
+		}
+		out[count].iov_base = (char *)iov[i].iov_base + offset;
+		out[count++].iov_len = take;
+		len -= take;
+		offset = 0;
+	}
+	return count;
+}
+
+
+/**
+ * @brief transfer the whole vector with preadv/pwritev, resuming after
+ *        short transfers (the descriptor cursor is never used)
+ */
+static int pio_transfer(int fd, const struct iovec *iov, int iovcnt,
+			off_t position, int write)
+{
+	// local copy, advanced as the transfer progresses
+	struct iovec vec[iovcnt];
+	memcpy(vec, iov, sizeof(vec));
+
+	int first = 0;
+	while (first < iovcnt) {
+		ssize_t done = write ? pwritev(fd, vec + first, iovcnt - first, position)
+			       : preadv(fd, vec + first, iovcnt - first, position);
+		if (done < 0 && errno == EINTR) {
+			continue;
+		}
+		// error or unexpected end of the disk
+		if (done <= 0) {
+			return ERR_IO;
+		}
+		position += done;
+
+		// skip the buffers completely transferred
+		size_t left = (size_t)done;
+		while (first < iovcnt && left >= vec[first].iov_len) {
+			left -= vec[first].iov_len;
+			++first;
+		}
+		if (first < iovcnt) {
+			vec[first].iov_base = (char *)vec[first].iov_base + left;
+			vec[first].iov_len -= left;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * @brief transfer the whole vector through the FILE* (fallback backend)
+ */
+static int stdio_transfer(FILE *f, const struct iovec *iov, int iovcnt,
+			  long position, int write)
+{
 	// if fseek did not work return ERR_IO
-	if(fseek(f, position, SEEK_SET) == 0) {
-		// if fread did not work return ERR_IO
-		if(fread(data, SECTOR_SIZE, 1, f) != 1) {
+	if (fseek(f, position, SEEK_SET) != 0) {
+		return ERR_IO;
+	}
+
+	for (int i = 0; i < iovcnt; ++i) {
+		if (iov[i].iov_len == 0) {
+			continue;
+		}
+		// if fread/fwrite did not work return ERR_IO
+		size_t count = write ? fwrite(iov[i].iov_base, iov[i].iov_len, 1, f)
+			       : fread(iov[i].iov_base, iov[i].iov_len, 1, f);
+		if (count != 1) {
 			return ERR_IO;
 		}
-	} else {
+	}
+	return 0;
+}
+
+
+/**
+ * @brief copy the vector out of the memory-mapped disk (read-only backend)
+ */
+static int mmap_transfer(const struct unix_filesystem *u, const struct iovec *iov,
+			 int iovcnt, size_t position, int write)
+{
+	if (write) {
+		return ERR_READ_ONLY;
+	}
+	if (position + iov_length(iov, iovcnt) > u->map_size) {
 		return ERR_IO;
 	}
 
+	for (int i = 0; i < iovcnt; ++i) {
+		memcpy(iov[i].iov_base, u->map + position, iov[i].iov_len);
+		position += iov[i].iov_len;
+	}
 	return 0;
 }
 
 
+int sector_transfer(const struct unix_filesystem *u, uint32_t sector,
+		    const struct iovec *iov, int iovcnt, int write)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(iov);
+	M_REQUIRE_NON_NULL(u->f);
+	if (iovcnt <= 0 || iovcnt > IOV_MAX || iov_length(iov, iovcnt) == 0) {
+		return ERR_BAD_PARAMETER;
+	}
+
+	// compute the offset to read
+	off_t position = (off_t)sector * SECTOR_SIZE;
 
-int sector_write(FILE *f, uint32_t sector, void  *data)
+	switch (u->io_mode) {
+	case SECTOR_IO_PREAD:
+		return pio_transfer(u->fd, iov, iovcnt, position, write);
+	case SECTOR_IO_MMAP:
+		return mmap_transfer(u, iov, iovcnt, (size_t)position, write);
+	default: {
+		// the cursor of the FILE* is shared by all the threads
+		flockfile(u->f);
+		int error = stdio_transfer(u->f, iov, iovcnt, (long)position, write);
+		funlockfile(u->f);
+		return error;
+	}
+	}
+}
+
+
+int sector_read(const struct unix_filesystem *u, uint32_t sector, void *data)
 {
 	// Test arguments
-	M_REQUIRE_NON_NULL(f);
+	M_REQUIRE_NON_NULL(u);
 	M_REQUIRE_NON_NULL(data);
 
-	// compute the offset to read
-	uint32_t position = sector * SECTOR_SIZE;
+	// served from the buffer cache when possible
+	if (u->cache != NULL && bcache_lookup(u->cache, sector, data)) {
+		return 0;
+	}
 
-	// if fseek did not work return ERR_IO
-	if(fseek(f, position, SEEK_SET) == 0) {
-		// if fread did not work return ERR_IO
-		int return_write = fwrite(data, SECTOR_SIZE, 1, f);
-		if(return_write != 1) {
-			return ERR_IO;
+	struct iovec iov = { data, SECTOR_SIZE };
+	int error = sector_transfer(u, sector, &iov, 1, 0);
+	if (!error && u->cache != NULL) {
+		bcache_insert(u->cache, sector, data);
+	}
+	return error;
+}
+
+
+
+int sector_write(const struct unix_filesystem *u, uint32_t sector, const void *data)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+	M_REQUIRE_NON_NULL(data);
+
+	// write-back: the sector reaches the disk at the next flush
+	if (u->cache != NULL && u->cache->dirty_max > 0) {
+		uint64_t now = now_ns();
+		if (bcache_write(u->cache, sector, data, now)) {
+			// every buffer is dirty: make room
+			int error = sector_flush(u);
+			if (error) {
+				return error;
+			}
+			(void)bcache_write(u->cache, sector, data, now);
+		}
+		return bcache_must_flush(u->cache, now) ? sector_flush(u) : 0;
+	}
+
+	// the buffer is only read from, the iovec type just has no const
+	struct iovec iov = { (void *)(uintptr_t)data, SECTOR_SIZE };
+	int error = sector_transfer(u, sector, &iov, 1, 1);
+
+	// write-through: keep the cached copy identical to the disk
+	if (u->cache != NULL) {
+		if (error) {
+			bcache_invalidate(u->cache, sector, 1);
+		} else {
+			bcache_insert(u->cache, sector, data);
 		}
-	} else {
-		return ERR_IO;
 	}
+	return error;
+}
+
+
+int sector_readv(const struct unix_filesystem *u, uint32_t sector,
+		 const struct iovec *iov, int iovcnt)
+{
+	// Test arguments (sector_transfer checks the others)
+	M_REQUIRE_NON_NULL(u);
+	size_t length = (iov != NULL && iovcnt > 0 && iovcnt <= IOV_MAX)
+			? iov_length(iov, iovcnt) : 0;
+	if (u->cache == NULL || length == 0) {
+		return sector_transfer(u, sector, iov, iovcnt, 0);
+	}
+
+	// bulk reads do not fill the cache so that streaming data does not
+	// evict metadata, but they use what it holds (e.g. read ahead)
+	uint32_t count = (uint32_t)(length / SECTOR_SIZE);
+	struct iovec part[iovcnt];
+	uint32_t i = 0;
+	while (i < count) {
+		// run of sectors to read from the disk
+		uint32_t run = 0;
+		while (i + run < count && !bcache_contains(u->cache, sector + i + run)) {
+			++run;
+		}
+		if (run > 0) {
+			int n = iov_slice(iov, iovcnt, (size_t)i * SECTOR_SIZE,
+					  (size_t)run * SECTOR_SIZE, part);
+			int error = sector_transfer(u, sector + i, part, n, 0);
+			if (error) {
+				return error;
+			}
+			i += run;
+			continue;
+		}
 
+		// cached sector, scattered like the disk read would have done
+		// (another thread may have evicted it meanwhile)
+		uint8_t data[SECTOR_SIZE];
+		if (!bcache_lookup(u->cache, sector + i, data)) {
+			struct iovec one = { data, SECTOR_SIZE };
+			int error = sector_transfer(u, sector + i, &one, 1, 0);
+			if (error) {
+				return error;
+			}
+		}
+		int n = iov_slice(iov, iovcnt, (size_t)i * SECTOR_SIZE, SECTOR_SIZE, part);
+		const uint8_t *from = data;
+		for (int k = 0; k < n; ++k) {
+			memcpy(part[k].iov_base, from, part[k].iov_len);
+			from += part[k].iov_len;
+		}
+		++i;
+	}
 	return 0;
 }
+
+
+int sector_writev(const struct unix_filesystem *u, uint32_t sector,
+		  const struct iovec *iov, int iovcnt)
+{
+	int error = sector_transfer(u, sector, iov, iovcnt, 1);
+	if (u != NULL && u->cache != NULL && iov != NULL && iovcnt > 0) {
+		bcache_invalidate(u->cache, sector,
+				  (uint32_t)(iov_length(iov, iovcnt) / SECTOR_SIZE));
+	}
+	return error;
+}
+
+
+int sector_flush(const struct unix_filesystem *u)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+	if (u->cache == NULL || bcache_ndirty(u->cache) == 0) {
+		return 0;
+	}
+
+	// one write-back at a time, so that a copy never overwrites a newer one
+	pthread_mutex_lock(&u->cache->flush_lock);
+	size_t ndirty = bcache_ndirty(u->cache);
+	struct bcache_copy *dirty = calloc(ndirty ? ndirty : 1, sizeof(*dirty));
+	if (dirty == NULL) {
+		pthread_mutex_unlock(&u->cache->flush_lock);
+		return ERR_NOMEM;
+	}
+
+	// dirty sectors by number, consecutive ones written at once
+	size_t count = bcache_dirty(u->cache, dirty, ndirty);
+	int error = 0;
+	size_t first = 0;
+	while (first < count && !error) {
+		size_t last = first + 1;
+		while (last < count && last - first < IOV_MAX
+		       && dirty[last].sector == dirty[last - 1].sector + 1) {
+			++last;
+		}
+
+		struct iovec iov[last - first];
+		for (size_t i = first; i < last; ++i) {
+			iov[i - first].iov_base = dirty[i].data;
+			iov[i - first].iov_len = SECTOR_SIZE;
+		}
+		error = sector_transfer(u, dirty[first].sector, iov, (int)(last - first), 1);
+		if (!error) {
+			bcache_mark_clean(u->cache, dirty + first, last - first);
+		}
+		first = last;
+	}
+
+	free(dirty);
+	pthread_mutex_unlock(&u->cache->flush_lock);
+	return error;
+}
+
+
+int sector_prefetch(const struct unix_filesystem *u, uint32_t sector, uint32_t count)
+{
+	// Test arguments
+	M_REQUIRE_NON_NULL(u);
+
+	// a mapped disk is paged in by the kernel, asynchronously
+	if (u->map != NULL) {
+		size_t from = (size_t)sector * SECTOR_SIZE;
+		if (from >= u->map_size) {
+			return 0;
+		}
+		size_t len = (size_t)count * SECTOR_SIZE;
+		if (len > u->map_size - from) {
+			len = u->map_size - from;
+		}
+		// the advice must start on a page boundary
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t start = from - from % page;
+		(void)posix_madvise((void *)(uintptr_t)(u->map + start), from + len - start,
+				    POSIX_MADV_WILLNEED);
+		return 0;
+	}
+	if (u->cache == NULL) {
+		return 0;
+	}
+
+	uint8_t batch[PREFETCH_BATCH][SECTOR_SIZE];
+	while (count > 0) {
+		// skip the sectors already cached
+		while (count > 0 && bcache_contains(u->cache, sector)) {
+			++sector;
+			--count;
+		}
+
+		// read the following missing ones at once
+		uint32_t n = 0;
+		while (n < count && n < PREFETCH_BATCH && !bcache_contains(u->cache, sector + n)) {
+			++n;
+		}
+		if (n == 0) {
+			break;
+		}
+		struct iovec iov = { batch, (size_t)n * SECTOR_SIZE };
+		int error = sector_transfer(u, sector, &iov, 1, 0);
+		if (error) {
+			return error;
+		}
+		for (uint32_t k = 0; k < n; ++k) {
+			bcache_insert(u->cache, sector + k, batch[k]);
+		}
+		sector += n;
+		count -= n;
+	}
+	return 0;
+}
+
+
+const void *sector_map(const struct unix_filesystem *u, uint32_t sector)
+{
+	if (u == NULL || u->map == NULL
+	    || ((size_t)sector + 1) * SECTOR_SIZE > u->map_size) {
+		return NULL;
+	}
+	return u->map + (size_t)sector * SECTOR_SIZE;
+}
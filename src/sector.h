@@ -10,34 +10,113 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct unix_filesystem;
+
+/**
+ * @brief how the sector layer reaches the virtual disk
+ */
+enum sector_io_mode {
+    SECTOR_IO_PREAD,    /* pread/pwrite on the descriptor of the disk (default) */
+    SECTOR_IO_STDIO,    /* fseek + fread/fwrite on the FILE* (fallback) */
+    SECTOR_IO_MMAP      /* read-only memory mapping of the whole disk */
+};
+
 // Implemented WEEK 4
 /**
  * @brief read one 512-byte sector from the virtual disk
- * @param f open file of the virtual disk
+ * @param u the mounted filesystem
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (OUT)
  * @return 0 on success; <0 on error
  */
-int sector_read(FILE *f, uint32_t sector, void *data);
+int sector_read(const struct unix_filesystem *u, uint32_t sector, void *data);
 
 
 // Implemented WEEK 11
 /**
- * @brief read one 512-byte sector from the virtual disk
- * @param f open file of the virtual disk
+ * @brief write one 512-byte sector to the virtual disk; with a write-back
+ *        buffer cache, it is only written by the next sector_flush()
+ * @param u the mounted filesystem
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (IN)
  * @return 0 on success; <0 on error
  */
-int sector_write(FILE *f, uint32_t sector, void  *data);
+int sector_write(const struct unix_filesystem *u, uint32_t sector, const void *data);
+
+/**
+ * @brief read consecutive sectors from the virtual disk, scattering them
+ *        over the given buffers (one preadv on the positional backend);
+ *        the sectors held by the buffer cache are copied from it, the
+ *        others are not added to it
+ * @param u the mounted filesystem
+ * @param sector the first sector to read
+ * @param iov the buffers to fill; their total length must be a multiple of SECTOR_SIZE (OUT)
+ * @param iovcnt the number of buffers in iov
+ * @return 0 on success; <0 on error
+ */
+int sector_readv(const struct unix_filesystem *u, uint32_t sector,
+                 const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief write consecutive sectors to the virtual disk, gathering them
+ *        from the given buffers (one pwritev on the positional backend)
+ * @param u the mounted filesystem
+ * @param sector the first sector to write
+ * @param iov the buffers to write; their total length must be a multiple of SECTOR_SIZE (IN)
+ * @param iovcnt the number of buffers in iov
+ * @return 0 on success; <0 on error
+ */
+int sector_writev(const struct unix_filesystem *u, uint32_t sector,
+                  const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief transfer consecutive sectors straight with the disk backend,
+ *        ignoring the buffer cache; may be called from several threads
+ *        at once on the positional and memory-mapped backends
+ * @param u the mounted filesystem
+ * @param sector the first sector
+ * @param iov the buffers; their total length must be a multiple of SECTOR_SIZE
+ * @param iovcnt the number of buffers in iov
+ * @param write 1 to write the buffers to the disk, 0 to read them
+ * @return 0 on success; <0 on error
+ */
+int sector_transfer(const struct unix_filesystem *u, uint32_t sector,
+                    const struct iovec *iov, int iovcnt, int write);
+
+/**
+ * @brief write back the dirty sectors of the buffer cache, in order, with
+ *        one vectored write per run of consecutive sectors
+ * @param u the mounted filesystem
+ * @return 0 on success; <0 on error
+ */
+int sector_flush(const struct unix_filesystem *u);
+
+/**
+ * @brief bring sectors into memory ahead of their use: read into the buffer
+ *        cache, or paged in when the disk is memory-mapped; a no-op otherwise.
+ *        The reads are synchronous: the call returns once the sectors are cached
+ * @param u the mounted filesystem
+ * @param sector the first sector
+ * @param count the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_prefetch(const struct unix_filesystem *u, uint32_t sector, uint32_t count);
+
+/**
+ * @brief zero-copy access to a sector of a memory-mapped disk
+ * @param u the mounted filesystem
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @return a pointer to the 512 bytes of the sector, valid until umount;
+ *         NULL if the disk is not mapped (use sector_read) or the sector is out of the disk
+ */
+const void *sector_map(const struct unix_filesystem *u, uint32_t sector);
 
 #ifdef __cplusplus
 }
 #endif
-
-
@@ -74,11 +74,9 @@ void print_sha_inode(struct unix_filesystem *u, struct inode inode, int inr) {
         unsigned char content[n_sector * SECTOR_SIZE];
 
         // Store the content of inode in content
-        size_t i = 0;
-        int read_bytes = filev6_readblock(&fv6, content);
-        while (read_bytes == SECTOR_SIZE) {
-                ++i;
-                read_bytes = filev6_readblock(&fv6, &(content[i*SECTOR_SIZE]));
+        int read_bytes = filev6_read(&fv6, content, inode_getsize(&inode));
+        if (read_bytes < 0) {
+                return;
         }
         // Print the sha only for the size of the inode
         print_sha_from_content(content, (size_t)inode_getsize(&inode));
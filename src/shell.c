@@ -9,6 +9,7 @@
 
 
 #define SHELL_CMD_SIZE 255
+#define CAT_CHUNK_SIZE (64 * SECTOR_SIZE)
 
 enum shell_error_codes {
         ERR_FIRST_SHELL = 1, // not an actual error but to set the first error number
@@ -47,6 +48,8 @@ int do_istat (const char** args);
 int do_inode (const char** args);
 int do_sha (const char** args);
 int do_psb (const char** args);
+int do_stats (const char** args);
+int do_sync (const char** args);
 
 
 struct shell_map {
@@ -58,7 +61,7 @@ struct shell_map {
 };
 
 
-#define NUMBER_OF_CMD 13
+#define NUMBER_OF_CMD 15
 static const struct shell_map shell_cmds[] = {
         { "help", do_help, "display this help", 0, ""},
         { "exit", do_exit, "exit shell", 0, ""},
@@ -72,7 +75,9 @@ static const struct shell_map shell_cmds[] = {
         { "istat", do_istat, "display information about the provided inode", 1, "<inode_nr>"},
         { "inode", do_inode, "display the inode number of a file", 1, "<pathname>"},
         { "sha", do_sha, "display the SHA of a file", 1, "<pathname>"},
-        { "psb", do_psb, "Print SuperBlock of the currently mounted filesystem", 0, ""}
+        { "psb", do_psb, "Print SuperBlock of the currently mounted filesystem", 0, ""},
+        { "stats", do_stats, "display the mount and cache statistics of the currently mounted filesystem", 0, ""},
+        { "sync", do_sync, "write the pending changes of the currently mounted filesystem to the disk", 0, ""}
 };
 
 int nmb_commands() {
@@ -183,7 +188,11 @@ int do_mount (const char** args)
 
 int do_mkdir(const char** args)
 {
-        return 0;
+        if(!is_mounted(&u)) {
+                return ERR_DISK_NOT_MOUNT;
+        }
+        int inr = direntv6_create(&u, args[1], IFDIR);
+        return inr < 0 ? inr : 0;
 }
 
 int do_lsall (const char** args)
@@ -197,7 +206,35 @@ int do_lsall (const char** args)
 
 int do_add(const char** args)
 {
-        return 0;
+        if(!is_mounted(&u)) {
+                return ERR_DISK_NOT_MOUNT;
+        }
+
+        FILE* src = fopen(args[1], "rb");
+        if (src == NULL) {
+                return ERR_IO_SHELL;
+        }
+
+        int inr = direntv6_create(&u, args[2], 0);
+        if (inr < 0) {
+                fclose(src);
+                return inr;
+        }
+
+        struct filev6 fs;
+        int error = filev6_open(&u, (uint16_t)inr, &fs);
+
+        // copy the file by large chunks, each appended in contiguous runs
+        char data[CAT_CHUNK_SIZE];
+        size_t read_bytes = 0;
+        while (!error && (read_bytes = fread(data, 1, CAT_CHUNK_SIZE, src)) > 0) {
+                error = filev6_writebytes(&u, &fs, data, (int)read_bytes);
+        }
+        if (!error && ferror(src)) {
+                error = ERR_IO_SHELL;
+        }
+        fclose(src);
+        return error;
 }
 
 int do_cat(const char** args)
@@ -218,13 +255,11 @@ int do_cat(const char** args)
                         return error;
                 }
                 //inode_print(&inr);
-                char data[inode_getsectorsize(&i)];
-                int read_bytes = filev6_readblock(&fs, data);
-                while(read_bytes == SECTOR_SIZE) { //correcteur : coherent with your readblock but please refactor
-                        data[SECTOR_SIZE] = '\0';
-                        printf("%s", data);
-                        memset(data, 0, SECTOR_SIZE);
-                        read_bytes = filev6_readblock(&fs, data);
+                char data[CAT_CHUNK_SIZE];
+                int read_bytes = filev6_read(&fs, data, CAT_CHUNK_SIZE);
+                while(read_bytes > 0) {
+                        fwrite(data, 1, (size_t)read_bytes, stdout);
+                        read_bytes = filev6_read(&fs, data, CAT_CHUNK_SIZE);
                 }
                 return read_bytes;
         } else {
@@ -288,6 +323,23 @@ int do_psb (const char** args)
         return ERR_DISK_NOT_MOUNT;
 }
 
+int do_stats (const char** args)
+{
+        if(is_mounted(&u)) {
+                mountv6_print_stats(&u);
+                return 0;
+        }
+        return ERR_DISK_NOT_MOUNT;
+}
+
+int do_sync (const char** args)
+{
+        if(is_mounted(&u)) {
+                return mountv6_sync(&u);
+        }
+        return ERR_DISK_NOT_MOUNT;
+}
+
 
 
 
@@ -368,7 +420,7 @@ int shell_execute(char** args)
 void shell_loop()
 {
         int error = 0;
-        char** args;
+        char** args = NULL;
         char* input;
         while (!feof(stdin) && !ferror(stdin) && error != EXIT_SHELL) {
                 error = 0;
@@ -385,7 +437,7 @@ void shell_loop()
 
                 // tokenize the input
                 if (error == 0) {
-                        error == tokenize_input(input, &args);
+                        error = tokenize_input(input, &args);
                 }
 
 
@@ -406,7 +458,7 @@ void shell_loop()
                 }
 
                 int i = 0;
-                while(args[i] != NULL) {
+                while(args != NULL && args[i] != NULL) {
                         args[i] = NULL;
                         ++i;
                 }
@@ -36,7 +36,34 @@ int main () {
 	bm_print(bmblock);
 	printf("find_next() = %d\n", bm_find_next(bmblock));
 
+	// full bitmap, then a single hole behind the cursor
+	for(size_t i = min; i <= bmblock->max; ++i) {
+		bm_set(bmblock, i);
+	}
+	printf("find_next() = %d\n", bm_find_next(bmblock));
+	bm_clear(bmblock, 100);
+	printf("find_next() = %d\n", bm_find_next(bmblock));
 
+	// runs: holes of 3 (at 10), 20 (at 40) and 5 (at 70)
+	bm_clear_range(bmblock, 10, 3);
+	bm_clear_range(bmblock, 40, 20);
+	bm_clear_range(bmblock, 70, 5);
+	printf("find_run(4, 0) = %d\n", bm_find_run(bmblock, 4, 0));
+	printf("find_run(4, 65) = %d\n", bm_find_run(bmblock, 4, 65));
+	printf("find_run(21, 0) = %d\n", bm_find_run(bmblock, 21, 0));
+	printf("find_best_run(4) = %d\n", bm_find_best_run(bmblock, 4));
+	printf("alloc_run(3, best) = %d\n", bm_alloc_run(bmblock, 3, 0, BM_BEST_FIT));
+	printf("alloc_run(3, next) = %d\n", bm_alloc_run(bmblock, 3, 0, BM_NEXT_FIT));
+	bm_print(bmblock);
+
+	// merge: the holes filled in another bitmap over the same range
+	struct bmblock_array *other = bm_alloc(min, bmblock->max);
+	if (other != NULL) {
+		bm_set_range(other, 40, 20);
+		printf("or() = %d\n", bm_or(bmblock, other));
+		printf("find_next() = %d\n", bm_find_next(bmblock));
+		free(other);
+	}
 
 
 	// free the pointer
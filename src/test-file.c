@@ -84,7 +84,7 @@ int test(struct unix_filesystem *u)
 
 	for(uint16_t i = 0; i < u->s.s_isize; ++i) {
 		// read the sector, and keep the error if any
-		error = sector_read(u->f, (uint32_t)u->s.s_inode_start + i, sector);
+		error = sector_read(u, (uint32_t)u->s.s_inode_start + i, sector);
 		if (error != 0) {
 			return error;
 		}
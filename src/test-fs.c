@@ -0,0 +1,203 @@
+/**
+ * @file test-fs.c
+ * @brief calls the operations of the FUSE daemon as the kernel would, two
+ *        handles on the same file, checking what each step lets the others
+ *        see; the disk is modified, run it on a scratch image (see check-fs
+ *        in the makefile)
+ */
+
+#define main fs_main
+#include "fs.c"
+#undef main
+
+#define TEST_FILE "/test-fs"
+#define TEST_MAX  (4 * SECTOR_SIZE)
+
+// what the file must contain
+static char expected[TEST_MAX];
+static off_t expected_size = 0;
+
+
+/**
+ * @brief number of values set in a bitmap
+ */
+static int bm_count(struct bmblock_array *bm)
+{
+	int count = 0;
+	for (uint64_t x = bm->min; x <= bm->max; ++x) {
+		count += (bm_get(bm, x) == 1);
+	}
+	return count;
+}
+
+
+/**
+ * @brief write len bytes of a pattern at offset through a handle
+ */
+static int write_at(struct fuse_file_info *fi, off_t offset, size_t len, char seed)
+{
+	char data[TEST_MAX];
+	for (size_t k = 0; k < len; ++k) {
+		data[k] = (char)(seed + (char)(k % 61));
+	}
+	int res = fs_write(TEST_FILE, data, len, offset, fi);
+	if (res != (int)len) {
+		return res < 0 ? res : -EIO;
+	}
+	memcpy(expected + offset, data, len);
+	if (offset + (off_t)len > expected_size) {
+		expected_size = offset + (off_t)len;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief print the size getattr gives and what a read through a handle
+ *        gets, compared with what the file must contain
+ * @param step what was just done
+ */
+static int check_file(struct fuse_file_info *fi, const char *step)
+{
+	struct stat st;
+	int res = fs_getattr(TEST_FILE, &st);
+	if (res) {
+		return res;
+	}
+	static char content[TEST_MAX + SECTOR_SIZE];
+	int read = fs_read(TEST_FILE, content, sizeof(content), 0, fi);
+	if (read < 0) {
+		return read;
+	}
+	printf("%-32s: getattr %5jd, read %5d, content %s\n", step, (intmax_t)st.st_size, read,
+	       (st.st_size == expected_size && read == expected_size
+		&& memcmp(content, expected, (size_t)read) == 0) ? "ok" : "MISMATCH");
+	return 0;
+}
+
+
+static int test(void)
+{
+	int blocks = bm_count(fs.fbm);
+	int inodes = bm_count(fs.ibm);
+	struct fuse_file_info fi1 = {0};
+	struct fuse_file_info fi2 = {0};
+
+	int error = fs_create(TEST_FILE, 0644, &fi1);
+	if (!error) {
+		error = fs_open(TEST_FILE, &fi2);
+	}
+
+	// buffered in the daemon, visible all the same
+	if (!error) {
+		error = write_at(&fi1, 0, 1000, 'a');
+	}
+	if (!error) {
+		error = check_file(&fi2, "write 1000, other handle");
+	}
+	if (!error) {
+		error = write_at(&fi1, 1000, 500, 'b');
+	}
+	if (!error) {
+		error = check_file(&fi1, "write 500 more, same handle");
+	}
+
+	// the pending bytes must not come back after the truncate
+	if (!error) {
+		error = write_at(&fi1, 1500, 300, 'c');
+	}
+	if (!error) {
+		error = fs_ftruncate(TEST_FILE, 0, &fi1);
+		expected_size = 0;
+	}
+	if (!error) {
+		error = fs_flush(TEST_FILE, &fi1);
+	}
+	if (!error) {
+		error = fs_release(TEST_FILE, &fi1);
+	}
+	if (!error) {
+		error = check_file(&fi2, "write 300, ftruncate 0, close");
+	}
+
+	// the same through the path
+	if (!error) {
+		error = write_at(&fi2, 0, 800, 'd');
+	}
+	if (!error) {
+		error = fs_truncate(TEST_FILE, 100);
+		expected_size = 100;
+	}
+	if (!error) {
+		error = check_file(&fi2, "write 800, truncate 100");
+	}
+
+	// pending bytes of a freed inode go nowhere
+	if (!error) {
+		error = write_at(&fi2, 100, 600, 'e');
+	}
+	if (!error) {
+		error = fs_unlink(TEST_FILE);
+	}
+	if (!error) {
+		error = fs_release(TEST_FILE, &fi2);
+	}
+	if (!error) {
+		printf("write 600, unlink, close: %d blocks used, %d inodes used\n",
+		       bm_count(fs.fbm) - blocks, bm_count(fs.ibm) - inodes);
+	}
+
+	// a read_buf reply may read its ranges of the disk after the truncate
+	struct fuse_bufvec *bufv = NULL;
+	if (!error) {
+		expected_size = 0;
+		error = fs_create(TEST_FILE, 0644, &fi1);
+	}
+	if (!error) {
+		error = write_at(&fi1, 0, 2000, 'f');
+	}
+	if (!error) {
+		error = fs_read_buf(TEST_FILE, &bufv, 2000, 0, &fi1);
+	}
+	if (!error) {
+		size_t fds = 0;
+		for (size_t k = 0; k < bufv->count; ++k) {
+			fds += (bufv->buf[k].flags & FUSE_BUF_IS_FD) ? 1 : 0;
+			free(bufv->buf[k].mem);
+		}
+		free(bufv);
+		error = fs_truncate(TEST_FILE, 0);
+		printf("read_buf (%zu ranges), truncate 0: %d blocks used\n", fds,
+		       bm_count(fs.fbm) - blocks);
+	}
+	if (!error) {
+		error = fs_release(TEST_FILE, &fi1);
+		printf("close: %d blocks used\n", bm_count(fs.fbm) - blocks);
+	}
+	if (!error) {
+		error = fs_unlink(TEST_FILE);
+	}
+	return error;
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fputs("Usage: test-fs <diskname>\n", stderr);
+		return 1;
+	}
+
+	int error = mountv6(argv[1], &fs);
+	if (!error) {
+		nversions = (size_t)fs.s.s_isize * INODES_PER_SECTOR;
+		versions = calloc(nversions, sizeof(struct fs_version));
+		error = test();
+	}
+	if (error) {
+		printf("error %d\n", error);
+	}
+	(void)umountv6(&fs);
+	free(versions);
+	return error ? 1 : 0;
+}
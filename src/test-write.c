@@ -0,0 +1,219 @@
+/**
+ * @file test-write.c
+ * @brief writes, truncates, renames and unlinks a file, checking after each
+ *        step its content against a copy kept in memory; the disk is
+ *        modified, run it on a scratch image (see check-write in the makefile)
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "inode.h"
+#include "filev6.h"
+#include "direntv6.h"
+#include "bmblock.h"
+
+#define TEST_FILE    "/test-write"
+#define TEST_RENAMED "/write.moved"
+#define TEST_MAX     (16 * SECTOR_SIZE)
+
+// what the file must contain
+static uint8_t expected[TEST_MAX];
+static int32_t expected_size = 0;
+
+
+/**
+ * @brief number of values set in a bitmap
+ */
+static int bm_count(struct bmblock_array *bm)
+{
+	int count = 0;
+	for (uint64_t x = bm->min; x <= bm->max; ++x) {
+		count += (bm_get(bm, x) == 1);
+	}
+	return count;
+}
+
+
+/**
+ * @brief fill part of the expected content with a pattern (seed 0: zeros)
+ */
+static void fill_pattern(uint8_t *buf, int32_t len, uint8_t seed)
+{
+	for (int32_t k = 0; k < len; ++k) {
+		buf[k] = seed ? (uint8_t)(seed + k % 251) : 0;
+	}
+}
+
+
+/**
+ * @brief read the whole file from disk and compare it with what it must
+ *        contain; print its size, its layout and the blocks in use
+ * @param step what was just done
+ * @param blocks the data blocks in use before the test
+ */
+static int check_file(struct unix_filesystem *u, const char *path, const char *step,
+		      int blocks)
+{
+	int inr = direntv6_dirlookup(u, ROOT_INUMBER, path);
+	if (inr < 0) {
+		printf("%s: lookup of %s failed\n", step, path);
+		return inr;
+	}
+	struct filev6 fv6;
+	int error = filev6_open(u, (uint16_t)inr, &fv6);
+	if (error) {
+		return error;
+	}
+
+	static uint8_t content[TEST_MAX + SECTOR_SIZE];
+	int read = filev6_read(&fv6, content, (int)sizeof(content));
+	if (read < 0) {
+		return read;
+	}
+	int32_t size = inode_getsize(&(fv6.i_node));
+	printf("%-28s: size %5" PRId32 ", %s, %2d blocks used, content %s\n", step, size,
+	       size >= 8 * SECTOR_SIZE ? "large" : "small", bm_count(u->fbm) - blocks,
+	       (read == expected_size && size == expected_size
+		&& memcmp(content, expected, (size_t)read) == 0) ? "ok" : "MISMATCH");
+	return 0;
+}
+
+
+/**
+ * @brief write len bytes of a pattern at offset, past the end of file if
+ *        need be (the gap then reads as zeros), as the FUSE daemon does
+ */
+static int write_at(struct unix_filesystem *u, const char *path, int32_t offset,
+		    int32_t len, uint8_t seed)
+{
+	int inr = direntv6_dirlookup(u, ROOT_INUMBER, path);
+	if (inr < 0) {
+		return inr;
+	}
+	struct filev6 fv6;
+	int error = filev6_open(u, (uint16_t)inr, &fv6);
+	if (!error && offset > inode_getsize(&(fv6.i_node))) {
+		error = filev6_truncate(u, &fv6, offset);
+	}
+	if (!error) {
+		error = filev6_lseek(&fv6, offset);
+	}
+
+	uint8_t data[TEST_MAX];
+	fill_pattern(data, len, seed);
+	if (!error) {
+		error = filev6_write(u, &fv6, data, len);
+	}
+	if (error < 0) {
+		return error;
+	}
+
+	if (offset > expected_size) {
+		fill_pattern(expected + expected_size, offset - expected_size, 0);
+	}
+	memcpy(expected + offset, data, (size_t)len);
+	if (offset + len > expected_size) {
+		expected_size = offset + len;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief change the size of the file
+ */
+static int truncate_to(struct unix_filesystem *u, const char *path, int32_t size)
+{
+	int inr = direntv6_dirlookup(u, ROOT_INUMBER, path);
+	if (inr < 0) {
+		return inr;
+	}
+	struct filev6 fv6;
+	int error = filev6_open(u, (uint16_t)inr, &fv6);
+	if (!error) {
+		error = filev6_truncate(u, &fv6, size);
+	}
+	if (error) {
+		return error;
+	}
+	if (size > expected_size) {
+		fill_pattern(expected + expected_size, size - expected_size, 0);
+	}
+	expected_size = size;
+	return 0;
+}
+
+
+int test(struct unix_filesystem *u)
+{
+	int blocks = bm_count(u->fbm);
+	int inodes = bm_count(u->ibm);
+
+	int inr = direntv6_create(u, TEST_FILE, 0);
+	if (inr < 0) {
+		return inr;
+	}
+	int error = check_file(u, TEST_FILE, "create", blocks);
+
+	// 3 sectors, the last one partly
+	if (!error) {
+		error = write_at(u, TEST_FILE, 0, 1300, 1);
+	}
+	if (!error) {
+		error = check_file(u, TEST_FILE, "write 1300 bytes", blocks);
+	}
+
+	// in place, across two sectors
+	if (!error) {
+		error = write_at(u, TEST_FILE, 300, 600, 2);
+	}
+	if (!error) {
+		error = check_file(u, TEST_FILE, "overwrite 600 at 300", blocks);
+	}
+
+	// past the end of file: zeros in between, and indirect blocks
+	if (!error) {
+		error = write_at(u, TEST_FILE, 5000, 700, 3);
+	}
+	if (!error) {
+		error = check_file(u, TEST_FILE, "write 700 at 5000 (gap)", blocks);
+	}
+
+	// back to direct addresses, then shorter within the last sector
+	if (!error) {
+		error = truncate_to(u, TEST_FILE, 2000);
+	}
+	if (!error) {
+		error = check_file(u, TEST_FILE, "truncate to 2000", blocks);
+	}
+	if (!error) {
+		error = truncate_to(u, TEST_FILE, 1800);
+	}
+	if (!error) {
+		error = check_file(u, TEST_FILE, "truncate to 1800", blocks);
+	}
+
+	// the same inode under a new name
+	if (!error) {
+		error = direntv6_rename(u, TEST_FILE, TEST_RENAMED);
+	}
+	if (!error) {
+		printf("rename: old name %s, same inode %s\n",
+		       direntv6_dirlookup(u, ROOT_INUMBER, TEST_FILE) < 0 ? "gone" : "STILL THERE",
+		       direntv6_dirlookup(u, ROOT_INUMBER, TEST_RENAMED) == inr ? "yes" : "NO");
+		error = check_file(u, TEST_RENAMED, "after rename", blocks);
+	}
+
+	// everything given back
+	if (!error) {
+		error = direntv6_unlink(u, TEST_RENAMED);
+	}
+	if (!error) {
+		printf("unlink: name %s, %d blocks used, %d inodes used\n",
+		       direntv6_dirlookup(u, ROOT_INUMBER, TEST_RENAMED) < 0 ? "gone" : "STILL THERE",
+		       bm_count(u->fbm) - blocks, bm_count(u->ibm) - inodes);
+	}
+	return error;
+}